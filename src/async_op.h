@@ -5,10 +5,25 @@
 #ifndef ASYNC_OP_H_
 #define ASYNC_OP_H_
 
-class async_op_base
+#include "mpsc_queue.h"
+#include "slab_allocator.h"
+
+/// Type erased task, linked intrusively into the threadpool's task queues.
+/// Task nodes are allocated from the thread local slab_allocator caches.
+class async_op_base : public snode::mpsc_node
 {
 public:
 
+    static void* operator new(std::size_t size)
+    {
+        return snode::slab_allocator::allocate(size);
+    }
+
+    static void operator delete(void* pointer, std::size_t size)
+    {
+        snode::slab_allocator::deallocate(pointer, size);
+    }
+
     void run()
     {
         func_(this);
@@ -6,6 +6,7 @@
 #define ASYNC_STREAMS_H_
 
 #include <ios>
+#include <atomic>
 #include <set>
 #include <sstream>
 #include <exception>
@@ -14,6 +15,7 @@
 #include <type_traits>
 
 #include "async_task.h"
+#include "slab_allocator.h"
 
 namespace snode
 {
@@ -115,6 +117,16 @@ namespace streams
           : streambuf_op_base(&async_streambuf_op::do_complete_ch, &async_streambuf_op::do_complete_size), handler_(h)
         {}
 
+        static void* operator new(std::size_t size)
+        {
+            return snode::slab_allocator::allocate(size);
+        }
+
+        static void operator delete(void* pointer, std::size_t size)
+        {
+            snode::slab_allocator::deallocate(pointer, size);
+        }
+
         static void do_complete_ch(streambuf_op_base* base, int_type ch)
         {
             async_streambuf_op* op(static_cast<async_streambuf_op*>(base));
@@ -153,8 +165,9 @@ namespace streams
         typedef async_istream<async_streambuf<TChar,TImpl> > istream_type;
 
     protected:
-        // The in/out mode for the buffer
-        bool stream_can_read_, stream_can_write_, stream_read_eof_, alloced_;
+        // The in/out mode for the buffer, atomic as the producer may close a buffer shared with the consumer thread
+        std::atomic<bool> stream_can_read_, stream_can_write_;
+        bool stream_read_eof_, alloced_;
 
         /// The real read head close operation,
         /// implementation should override it if there is any resource to be released.
@@ -200,6 +213,13 @@ namespace streams
             alloced_ = false;
         }
 
+        /// Copy the stream state, the I/O mode flags are atomic and not copyable themselves.
+        async_streambuf(const async_streambuf& other)
+            : std::enable_shared_from_this<async_streambuf<TChar,TImpl> >(other),
+              stream_can_read_(other.stream_can_read_.load()), stream_can_write_(other.stream_can_write_.load()),
+              stream_read_eof_(other.stream_read_eof_), alloced_(other.alloced_)
+        {}
+
         /// Constructs an input stream head for this stream buffer.
         istream_type create_istream()
         {
@@ -562,7 +582,7 @@ namespace streams
         /// a subsequent read will not succeed.
         bool acquire(char_type*& ptr, size_t& count)
         {
-            if (can_write())
+            if (can_read())
                 return get_impl()->acquire(ptr, count);
             else
                 return false;
@@ -574,7 +594,7 @@ namespace streams
         /// (count) The number of characters that were read.
         void release(char_type* ptr, size_t count)
         {
-            if (can_write())
+            if (can_read())
                 get_impl()->release(ptr, count);
         }
     };
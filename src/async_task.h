@@ -18,6 +18,12 @@ class async_task
 {
 public:
 
+    /// Schedule all tasks from a batch with a single queue operation, see threadpool::schedule_batch().
+    static void inline connect_batch(task_batch& batch, thread_id_t id = THIS_THREAD_ID())
+    {
+        snode_core::instance().get_threadpool().schedule_batch(batch, id);
+    }
+
     template<typename F>
     static void inline connect(F func, thread_id_t id = THIS_THREAD_ID())
     {
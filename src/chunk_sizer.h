@@ -0,0 +1,129 @@
+//
+// chunk_sizer.h
+// Copyright (C) 2015  Emil Penchev, Bulgaria
+
+#ifndef CHUNK_SIZER_H_
+#define CHUNK_SIZER_H_
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <algorithm>
+
+namespace snode
+{
+
+/// Body transfer statistics of a connection, one direction.
+struct transfer_stats
+{
+    uint64_t bytes;         /// bytes moved
+    uint64_t transfers;     /// reads or writes issued
+    uint32_t grows;         /// chunk size doubled
+    uint32_t shrinks;       /// chunk size halved, by slow transfers or memory pressure
+    std::size_t max_chunk;  /// largest chunk size reached
+};
+
+/// Adaptive read or write granularity of a connection.
+/// Starts at s_min_chunk and doubles up to the configured maximum while the socket (or the body producer)
+/// keeps filling whole chunks, halves when a transfer fills less than a quarter of it. The chunk sizes of all
+/// connections are accounted process wide, past the configured memory budget chunks only shrink.
+class chunk_sizer
+{
+public:
+    static const std::size_t s_min_chunk = 4 * 1024;
+    static const std::size_t s_default_max_chunk = 256 * 1024;
+    static const std::size_t s_default_memory_budget = 64 * 1024 * 1024;
+
+    chunk_sizer() : size_(s_min_chunk)
+    {
+        stats_ = transfer_stats();
+        stats_.max_chunk = size_;
+        limits().in_use_ += size_;
+    }
+
+    ~chunk_sizer()
+    {
+        limits().in_use_ -= size_;
+    }
+
+    chunk_sizer(const chunk_sizer&) = delete;
+    chunk_sizer& operator=(const chunk_sizer&) = delete;
+
+    /// Set the largest chunk size and the memory budget for the chunks of all connections.
+    static void configure(std::size_t max_chunk, std::size_t memory_budget)
+    {
+        limits().max_chunk_ = max_chunk < s_min_chunk ? static_cast<std::size_t>(s_min_chunk) : max_chunk;
+        limits().budget_ = memory_budget;
+    }
+
+    static std::size_t max_chunk() { return limits().max_chunk_; }
+
+    /// Memory held by the chunks of all connections.
+    static std::size_t in_use() { return limits().in_use_; }
+
+    /// Current chunk size.
+    std::size_t size() const { return size_; }
+
+    /// Account a transfer of (transferred) bytes out of (requested) and adapt the chunk size.
+    /// Requests smaller than the chunk (the end of a body) say nothing about the connection.
+    void update(std::size_t requested, std::size_t transferred)
+    {
+        stats_.transfers++;
+        stats_.bytes += transferred;
+
+        if (limits().in_use_ > limits().budget_)
+            resize(size_ / 2);
+        else if (requested >= size_ && transferred >= requested)
+            resize(size_ * 2);
+        else if (requested >= size_ && transferred < size_ / 4)
+            resize(size_ / 2);
+    }
+
+    const transfer_stats& stats() const { return stats_; }
+
+private:
+    struct global_limits
+    {
+        global_limits() : max_chunk_(s_default_max_chunk), budget_(s_default_memory_budget), in_use_(0) {}
+
+        std::size_t max_chunk_;
+        std::size_t budget_;
+        std::atomic<std::size_t> in_use_;
+    };
+
+    static global_limits& limits()
+    {
+        static global_limits s_limits;
+        return s_limits;
+    }
+
+    void resize(std::size_t size)
+    {
+        if (size < s_min_chunk)
+            size = s_min_chunk;
+        if (size > limits().max_chunk_)
+            size = limits().max_chunk_;
+        if (size == size_)
+            return;
+
+        if (size > size_)
+        {
+            limits().in_use_ += size - size_;
+            stats_.grows++;
+        }
+        else
+        {
+            limits().in_use_ -= size_ - size;
+            stats_.shrinks++;
+        }
+        size_ = size;
+        stats_.max_chunk = std::max(stats_.max_chunk, size_);
+    }
+
+    std::size_t size_;
+    transfer_stats stats_;
+};
+
+}
+
+#endif /* CHUNK_SIZER_H_ */
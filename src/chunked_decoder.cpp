@@ -0,0 +1,177 @@
+//
+// chunked_decoder.cpp
+// Copyright (C) 2015  Emil Penchev, Bulgaria
+
+#include "chunked_decoder.h"
+
+namespace snode
+{
+namespace http
+{
+
+namespace
+{
+    inline int hex_value(char ch)
+    {
+        if (ch >= '0' && ch <= '9')
+            return ch - '0';
+        if (ch >= 'a' && ch <= 'f')
+            return ch - 'a' + 10;
+        if (ch >= 'A' && ch <= 'F')
+            return ch - 'A' + 10;
+        return -1;
+    }
+}
+
+void chunked_decoder::reset()
+{
+    state_ = state::size;
+    payload_left_ = 0;
+    body_size_ = 0;
+    digits_ = 0;
+    line_ = 0;
+}
+
+void chunked_decoder::consume_payload(uint64_t count)
+{
+    if (count > payload_left_)
+        count = payload_left_;
+
+    payload_left_ -= count;
+    body_size_ += count;
+    if (!payload_left_ && state::data == state_)
+        state_ = state::data_cr;
+}
+
+chunked_decoder::result chunked_decoder::parse(const char* data, size_t size, size_t& consumed)
+{
+    size_t pos = 0;
+    consumed = 0;
+
+    while (pos < size)
+    {
+        char ch = data[pos];
+        switch (state_)
+        {
+        case state::size:
+        {
+            int value = hex_value(ch);
+            if (value >= 0)
+            {
+                // 16 hex digits fill 64 bits
+                if (payload_left_ >> 60)
+                    return fail();
+                payload_left_ = (payload_left_ << 4) | static_cast<uint64_t>(value);
+                digits_++;
+                break;
+            }
+            if (!digits_)
+                return fail();
+
+            if (' ' == ch || '\t' == ch)
+                state_ = state::size_ws;
+            else if (';' == ch)
+                state_ = state::extension;
+            else if ('\r' == ch)
+                state_ = state::size_lf;
+            else
+                return fail();
+            break;
+        }
+
+        case state::size_ws:
+            if (';' == ch)
+                state_ = state::extension;
+            else if ('\r' == ch)
+                state_ = state::size_lf;
+            else if (ch != ' ' && ch != '\t')
+                return fail();
+            break;
+
+        case state::extension:
+            if ('\r' == ch)
+                state_ = state::size_lf;
+            else if (++line_ > s_max_extension || '\n' == ch)
+                return fail();
+            break;
+
+        case state::size_lf:
+            if (ch != '\n')
+                return fail();
+
+            digits_ = 0;
+            line_ = 0;
+            if (!payload_left_)
+            {
+                state_ = state::trailer_start;
+                break;
+            }
+
+            state_ = state::data;
+            consumed = pos + 1;
+            return payload;
+
+        case state::data:
+            // the caller has not taken the chunk data
+            consumed = pos;
+            return payload;
+
+        case state::data_cr:
+            if (ch != '\r')
+                return fail();
+            state_ = state::data_lf;
+            break;
+
+        case state::data_lf:
+            if (ch != '\n')
+                return fail();
+            state_ = state::size;
+            break;
+
+        case state::trailer_start:
+            if ('\r' == ch)
+            {
+                state_ = state::last_lf;
+                break;
+            }
+            state_ = state::trailer;
+            // fall through, the character is part of the trailer field
+
+        case state::trailer:
+            if ('\r' == ch)
+                state_ = state::trailer_lf;
+            else if (++line_ > s_max_trailer || '\n' == ch)
+                return fail();
+            break;
+
+        case state::trailer_lf:
+            if (ch != '\n')
+                return fail();
+            state_ = state::trailer_start;
+            break;
+
+        case state::last_lf:
+            if (ch != '\n')
+                return fail();
+            state_ = state::finished;
+            consumed = pos + 1;
+            return done;
+
+        case state::finished:
+            return done;
+
+        case state::failed:
+            return error;
+        }
+        pos++;
+    }
+
+    consumed = pos;
+    if (state::data == state_)
+        return payload;
+    if (state::finished == state_)
+        return done;
+    return state::failed == state_ ? error : incomplete;
+}
+
+}}
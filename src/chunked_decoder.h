@@ -0,0 +1,92 @@
+//
+// chunked_decoder.h
+// Copyright (C) 2015  Emil Penchev, Bulgaria
+
+#ifndef CHUNKED_DECODER_H_
+#define CHUNKED_DECODER_H_
+
+#include <cstddef>
+#include <cstdint>
+
+namespace snode
+{
+namespace http
+{
+
+/// Incremental decoder of the chunked transfer coding (RFC 7230 4.1).
+/// parse() consumes the framing - chunk size lines with their extensions, the CRLF after the chunk data, the last
+/// chunk and the trailer - and stops at chunk data. The payload is moved by the caller, from the same buffer or
+/// straight from the socket, and reported with consume_payload(). Nothing is buffered, the input may be split
+/// anywhere, so a chunk of any size is decoded in constant memory. Chunk extensions and trailer fields are skipped.
+class chunked_decoder
+{
+public:
+
+    /// Longest chunk size line extension and the longest trailer, messages with longer ones are rejected.
+    static const size_t s_max_extension = 4 * 1024;
+    static const size_t s_max_trailer = 8 * 1024;
+
+    enum result
+    {
+        incomplete, /// need more data
+        payload,    /// payload_left() bytes of chunk data follow
+        done,       /// the last chunk and the trailer are consumed
+        error       /// malformed chunked body
+    };
+
+    chunked_decoder()
+    {
+        reset();
+    }
+
+    /// Prepare for a new message body.
+    void reset();
+
+    /// Decode the framing from (data, size). (consumed) is set to the number of bytes used, which stops at the start
+    /// of chunk data or at the end of the message - whatever follows it (a pipelined request) is left alone.
+    result parse(const char* data, size_t size, size_t& consumed);
+
+    /// Chunk data bytes the caller has to take before the next parse().
+    uint64_t payload_left() const { return payload_left_; }
+
+    /// Report (count) bytes of chunk data as taken, at most payload_left().
+    void consume_payload(uint64_t count);
+
+    /// Total chunk data bytes of the message so far.
+    uint64_t body_size() const { return body_size_; }
+
+private:
+
+    enum class state : uint8_t
+    {
+        size,           // hex digits of the chunk size
+        size_ws,        // whitespace after the size
+        extension,      // ";name=value" up to CR
+        size_lf,        // LF of the size line
+        data,           // chunk data, taken by the caller
+        data_cr,        // CRLF after the chunk data
+        data_lf,
+        trailer_start,  // start of a trailer field or the final CRLF
+        trailer,        // trailer field up to CR
+        trailer_lf,     // LF of a trailer field
+        last_lf,        // LF of the final CRLF
+        finished,
+        failed
+    };
+
+    result fail()
+    {
+        state_ = state::failed;
+        return error;
+    }
+
+    state state_;
+    uint64_t payload_left_;
+    uint64_t body_size_;
+    size_t digits_;     // digits of the chunk size
+    size_t line_;       // length of the extension or of the trailer so far
+};
+
+}}
+
+#endif /* CHUNKED_DECODER_H_ */
@@ -13,12 +13,16 @@ namespace snode
 // general
 static const char* s_threads_section = "threads";
 static const char* s_daemon_section = "daemon";
+static const char* s_multireactor_section = "multireactor";
+static const char* s_affinity_section = "affinity";
+static const char* s_numanode_section = "numanode";
 static const char* s_logfile_section = "logfile";
 static const char* s_admin_user_section = "admin.username";
 static const char* s_admin_password_section = "admin.password";
 static const char* s_options_section = "options";
 // streams
 static const char* s_streams_section = "streams";
+static const char* s_streams_name_section = "name";
 static const char* s_streams_location_section = "location";
 static const char* s_streams_live_section = "live";
 static const char* s_streams_source_section = "source";
@@ -53,6 +57,23 @@ unsigned snode_config::threads()
     return ptree_.get(s_threads_section, 1);
 }
 
+bool snode_config::multi_reactor()
+{
+    // don't consider default value as error
+    return ptree_.get(s_multireactor_section, 0) != 0;
+}
+
+std::string snode_config::affinity()
+{
+    return ptree_.get(s_affinity_section, "none");
+}
+
+int snode_config::numa_node()
+{
+    // don't consider default value as error
+    return ptree_.get(s_numanode_section, -1);
+}
+
 bool snode_config::daemonize()
 {
     try
@@ -118,6 +139,7 @@ void snode_config::read_streams()
                 stream.options[s_streams_live_section] = "1";
             }
 
+            stream.name = iter->second.get<std::string>(s_streams_name_section);
             stream.location = iter->second.get<std::string>(s_streams_location_section);
             std::string source_class = iter->second.get<std::string>(s_streams_source_section, "");
             if (!source_class.empty())
@@ -83,6 +83,15 @@ public:
     /// Get threads count.
     unsigned threads();
 
+    /// Get multi-reactor option, every worker thread runs its own io_service.
+    bool multi_reactor();
+
+    /// Get worker CPU affinity, "none", "auto" (one worker per CPU) or a CPU list ("0-3,8").
+    std::string affinity();
+
+    /// Get the NUMA node the workers are placed on, -1 if not set.
+    int numa_node();
+
     /// Get log file pathname
     std::string logfile();
 
@@ -0,0 +1,187 @@
+//
+// cpu_affinity.cpp
+// Copyright (C) 2015  Emil Penchev, Bulgaria
+
+#include "cpu_affinity.h"
+
+#include <fstream>
+#include <sstream>
+#include <cstdlib>
+#include <algorithm>
+
+#if defined(__linux__)
+#include <pthread.h>
+#include <sched.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+#include <linux/mempolicy.h>
+#endif
+
+namespace snode
+{
+static const char* s_affinity_none = "none";
+static const char* s_affinity_auto = "auto";
+static const char* s_numa_node_path = "/sys/devices/system/node/node";
+
+bool apply_worker_placement(const worker_placement& placement)
+{
+#if defined(__linux__)
+    bool result = true;
+    if (!placement.cpus.empty())
+    {
+        cpu_set_t cpuset;
+        CPU_ZERO(&cpuset);
+        for (auto cpu : placement.cpus)
+        {
+            if (cpu >= 0 && cpu < CPU_SETSIZE)
+                CPU_SET(cpu, &cpuset);
+        }
+
+        if (pthread_setaffinity_np(pthread_self(), sizeof(cpuset), &cpuset))
+            result = false;
+    }
+
+    if (placement.numa_node >= 0)
+    {
+        // preferred, not bound, allocations fall back to other nodes when the node runs out of memory
+        const unsigned long bits = 8 * sizeof(unsigned long);
+        std::vector<unsigned long> nodemask(placement.numa_node / bits + 1, 0);
+        nodemask[placement.numa_node / bits] = 1UL << (placement.numa_node % bits);
+        if (syscall(SYS_set_mempolicy, MPOL_PREFERRED, nodemask.data(), nodemask.size() * bits + 1))
+            result = false;
+    }
+    return result;
+#else
+    return placement.cpus.empty() && placement.numa_node < 0;
+#endif
+}
+
+bool parse_cpu_list(const std::string& list, std::vector<int>& cpus)
+{
+    std::stringstream stream(list);
+    std::string range;
+    cpus.clear();
+
+    while (std::getline(stream, range, ','))
+    {
+        range.erase(std::remove_if(range.begin(), range.end(), ::isspace), range.end());
+        if (range.empty())
+            continue;
+
+        char* end = nullptr;
+        long first = std::strtol(range.c_str(), &end, 10);
+        long last = first;
+        if (end == range.c_str())
+            return false;
+
+        if ('-' == *end)
+        {
+            const char* second = end + 1;
+            last = std::strtol(second, &end, 10);
+            if (end == second)
+                return false;
+        }
+
+        if (*end || first < 0 || last < first)
+            return false;
+
+        for (long cpu = first; cpu <= last; cpu++)
+            cpus.push_back(static_cast<int>(cpu));
+    }
+
+    return !cpus.empty();
+}
+
+bool numa_node_cpus(int node, std::vector<int>& cpus)
+{
+    std::ifstream file(s_numa_node_path + std::to_string(node) + "/cpulist");
+    std::string list;
+    if (!file || !std::getline(file, list))
+        return false;
+
+    return parse_cpu_list(list, cpus);
+}
+
+/// CPUs the process may run on.
+static void allowed_cpus(std::vector<int>& cpus)
+{
+    cpus.clear();
+#if defined(__linux__)
+    cpu_set_t cpuset;
+    CPU_ZERO(&cpuset);
+    if (!sched_getaffinity(0, sizeof(cpuset), &cpuset))
+    {
+        for (int cpu = 0; cpu < CPU_SETSIZE; cpu++)
+        {
+            if (CPU_ISSET(cpu, &cpuset))
+                cpus.push_back(cpu);
+        }
+    }
+#endif
+}
+
+bool make_worker_placement(const std::string& affinity, int numa_node, worker_placement_list& placement)
+{
+    placement.clear();
+
+    std::vector<int> cpus;
+    if (numa_node >= 0)
+    {
+        if (!numa_node_cpus(numa_node, cpus))
+            return false;
+    }
+    else
+    {
+        allowed_cpus(cpus);
+    }
+
+    if (affinity.empty() || affinity == s_affinity_none)
+    {
+        // workers float between all CPUs of the node
+        if (numa_node >= 0)
+        {
+            worker_placement node;
+            node.cpus = cpus;
+            node.numa_node = numa_node;
+            placement.push_back(node);
+        }
+        return true;
+    }
+
+    if (affinity != s_affinity_auto)
+    {
+        std::vector<int> listed;
+        if (!parse_cpu_list(affinity, listed))
+            return false;
+
+        // the node restricts an explicit list too, no worker is pinned off the node its memory comes from
+        if (numa_node >= 0)
+        {
+            std::vector<int> node_cpus;
+            node_cpus.swap(cpus);
+            for (auto cpu : listed)
+            {
+                if (std::find(node_cpus.begin(), node_cpus.end(), cpu) != node_cpus.end())
+                    cpus.push_back(cpu);
+            }
+            if (cpus.empty())
+                return false;
+        }
+        else
+        {
+            cpus.swap(listed);
+        }
+    }
+
+    // one CPU per worker
+    for (auto cpu : cpus)
+    {
+        worker_placement worker;
+        worker.cpus.push_back(cpu);
+        worker.numa_node = numa_node;
+        placement.push_back(worker);
+    }
+    return !placement.empty();
+}
+
+}
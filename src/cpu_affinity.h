@@ -0,0 +1,49 @@
+//
+// cpu_affinity.h
+// Copyright (C) 2015  Emil Penchev, Bulgaria
+//
+
+#ifndef CPU_AFFINITY_H_
+#define CPU_AFFINITY_H_
+
+#include <string>
+#include <vector>
+
+namespace snode
+{
+
+/// Where a worker thread runs, the CPUs it may be scheduled on and the NUMA node its memory should come from.
+/// An empty cpu list leaves scheduling to the OS, a negative numa node leaves the memory policy unchanged.
+struct worker_placement
+{
+    worker_placement() : numa_node(-1)
+    {}
+
+    std::vector<int> cpus;
+    int numa_node;
+};
+
+typedef std::vector<worker_placement> worker_placement_list;
+
+/// Apply placement to the calling thread. Memory is allocated on first touch,
+/// so a worker applies it at start before it allocates its own queues and buffers.
+/// Returns false if the OS rejected it (the thread keeps running unplaced) or it is not supported.
+bool apply_worker_placement(const worker_placement& placement);
+
+/// Parse a CPU list in the kernel's cpulist format ("0-3,8,10-11").
+/// Returns false on a malformed list.
+bool parse_cpu_list(const std::string& list, std::vector<int>& cpus);
+
+/// Get the CPUs of a NUMA node (from /sys/devices/system/node/). Returns false if there is no such node.
+bool numa_node_cpus(int node, std::vector<int>& cpus);
+
+/// Build the per worker placement from the configuration.
+/// affinity is "none", "auto" (one worker per CPU) or an explicit CPU list, workers take the CPUs in order, round robin.
+/// numa_node >= 0 restricts the workers to the CPUs of that node and prefers its memory,
+/// an explicit list is narrowed to the node's CPUs.
+/// Returns false on an invalid configuration or a list with no CPU on the node, an empty list means no placement at all.
+bool make_worker_placement(const std::string& affinity, int numa_node, worker_placement_list& placement);
+
+}
+
+#endif /* CPU_AFFINITY_H_ */
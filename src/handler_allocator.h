@@ -5,45 +5,105 @@
 #ifndef _HANDLER_ALLOCATOR_H_
 #define _HANDLER_ALLOCATOR_H_
 
-#include <boost/aligned_storage.hpp>
+#include <atomic>
+#include <cstdint>
+#include <cstddef>
 
 #include "snode_types.h"
 #include "async_task.h"
+#include "slab_allocator.h"
 
 namespace snode
 {
 
-static const int alloc_size = 1024;
+/// handler_allocator usage counters.
+struct handler_alloc_stats
+{
+    handler_alloc_stats() : allocations(0), fallback_busy(0), fallback_size(0)
+    {}
+
+    uint64_t allocations;   /// allocation requests of the already destroyed allocators (closed connections)
+    uint64_t fallback_busy; /// requests that fit a slot but all slots of the size class were in use
+    uint64_t fallback_size; /// requests bigger than the largest slot
+};
 
-/// Class to manage the memory to be used for custom allocation of ASIO handler objects .
-/// It contains a single block of memory which may be returned for allocation
-/// requests. If the memory is in use when an allocation request is made, the
-/// allocator delegates allocation to the global heap.
+/// Class to manage the memory to be used for custom allocation of ASIO handler objects.
+/// It contains a few fixed slots in two size classes (small and large), enough for the concurrent
+/// operations of one connection (read, write, timer). Slot ownership is tracked in an atomic bitmask,
+/// since a handler may be freed on the I/O thread while the worker starts another operation.
+/// If no slot fits, the allocator delegates allocation to the thread's slab_allocator and counts a fallback.
 class handler_allocator
 {
 public:
-    handler_allocator() : in_use_(false)
+    handler_allocator() : in_use_(0), allocations_(0), fallbacks_(0)
     {}
 
     void* allocate(std::size_t size)
     {
-        if (!in_use_ && size < storage_.size)
+        allocations_.fetch_add(1, std::memory_order_relaxed);
+        if (size <= s_small_size)
         {
-            in_use_ = true;
-            return storage_.address();
+            if (void* pointer = take_slot(0, s_small_slots))
+                return pointer;
+        }
+
+        if (size <= s_large_size)
+        {
+            if (void* pointer = take_slot(s_small_slots, s_small_slots + s_large_slots))
+                return pointer;
+            fallbacks_.fetch_add(1, std::memory_order_relaxed);
+            global_counters().fallback_busy++;
         }
         else
         {
-            return ::operator new(size);
+            fallbacks_.fetch_add(1, std::memory_order_relaxed);
+            global_counters().fallback_size++;
         }
+        return slab_allocator::allocate(size);
     }
 
-    void deallocate(void* pointer)
+    void deallocate(void* pointer, std::size_t size)
     {
-        if (pointer == storage_.address())
-            in_use_ = false;
+        char* address = static_cast<char*>(pointer);
+        if (address >= small_storage_[0].data_ && address < small_storage_[s_small_slots - 1].data_ + s_small_size)
+        {
+            in_use_.fetch_and(~(1u << ((address - small_storage_[0].data_) / s_small_size)));
+        }
+        else if (address >= large_storage_[0].data_ && address < large_storage_[s_large_slots - 1].data_ + s_large_size)
+        {
+            in_use_.fetch_and(~(1u << (s_small_slots + (address - large_storage_[0].data_) / s_large_size)));
+        }
         else
-            ::operator delete(pointer);
+        {
+            slab_allocator::deallocate(pointer, size);
+        }
+    }
+
+    /// Get the count of allocations served by this allocator.
+    uint64_t allocations() const
+    {
+        return allocations_.load(std::memory_order_relaxed);
+    }
+
+    /// Get the count of allocations which did not fit into a free slot of this allocator.
+    uint64_t fallbacks() const
+    {
+        return fallbacks_.load(std::memory_order_relaxed);
+    }
+
+    /// Get the counters summed over all handler allocators, fallbacks are counted as they happen.
+    static handler_alloc_stats stats()
+    {
+        handler_alloc_stats result;
+        result.fallback_busy = global_counters().fallback_busy;
+        result.fallback_size = global_counters().fallback_size;
+        result.allocations = global_counters().allocations;
+        return result;
+    }
+
+    ~handler_allocator()
+    {
+        global_counters().allocations += allocations_.load(std::memory_order_relaxed);
     }
 
 private:
@@ -51,17 +111,66 @@ private:
     handler_allocator(const handler_allocator&);
     void operator=(const handler_allocator&);
 
+    static const std::size_t s_small_size = 256;
+    static const std::size_t s_small_slots = 4;
+    static const std::size_t s_large_size = 1024;
+    static const std::size_t s_large_slots = 2;
+
+    struct global_stats
+    {
+        std::atomic<uint64_t> allocations;
+        std::atomic<uint64_t> fallback_busy;
+        std::atomic<uint64_t> fallback_size;
+    };
+
+    static global_stats& global_counters()
+    {
+        static global_stats counters = { {0}, {0}, {0} };
+        return counters;
+    }
+
+    /// Claim a free slot in [first, last), slot bit n is slot n of the small storage followed by the large storage.
+    void* take_slot(std::size_t first, std::size_t last)
+    {
+        uint32_t mask = in_use_.load();
+        for (std::size_t slot = first; slot < last; slot++)
+        {
+            uint32_t bit = 1u << slot;
+            while (!(mask & bit))
+            {
+                if (in_use_.compare_exchange_weak(mask, mask | bit))
+                {
+                    return slot < s_small_slots ? small_storage_[slot].data_
+                                                : large_storage_[slot - s_small_slots].data_;
+                }
+            }
+        }
+        return nullptr;
+    }
+
+    template<std::size_t Size>
+    struct slot_storage
+    {
+        alignas(std::max_align_t) char data_[Size];
+    };
+
     // Storage space used for handler-based custom memory allocation.
-    boost::aligned_storage<alloc_size> storage_;
+    slot_storage<s_small_size> small_storage_[s_small_slots];
+    slot_storage<s_large_size> large_storage_[s_large_slots];
+
+    // Slots of the handler-based custom allocation storage which are in use, one bit per slot.
+    std::atomic<uint32_t> in_use_;
 
-    // Whether the handler-based custom allocation storage has been used.
-    bool in_use_;
+    // Counters, composed operations may allocate on the I/O thread while the worker starts another operation.
+    std::atomic<uint64_t> allocations_;
+    std::atomic<uint64_t> fallbacks_;
 };
 
 
 /// Wrapper class template for handler objects to allow handler memory
 /// allocation to be customized and handler to be dispatched to a given worker thread.
-/// Calls to operator() are forwarded to the encapsulated handler.
+/// Calls to operator() are forwarded to the encapsulated handler,
+/// directly if the completion already runs on the worker thread (multi-reactor mode).
 /// A custom allocator strategy can be specified via the Allocator template parameter.
 template <typename Handler, typename Allocator>
 class asio_handler_dispatcher
@@ -74,31 +183,46 @@ public:
     template <typename Arg1>
     void operator()(Arg1 arg1)
     {
-        async_task::connect(handler_, arg1, thread_id_);
+        if (THIS_THREAD_ID() == thread_id_)
+            handler_(arg1);
+        else
+            async_task::connect(handler_, arg1, thread_id_);
     }
 
     template <typename Arg1, typename Arg2>
     void operator()(Arg1 arg1, Arg2 arg2)
     {
-        async_task::connect(handler_, arg1, arg2, thread_id_);
+        if (THIS_THREAD_ID() == thread_id_)
+            handler_(arg1, arg2);
+        else
+            async_task::connect(handler_, arg1, arg2, thread_id_);
     }
 
     template <typename Arg1, typename Arg2, typename Arg3>
     void operator()(Arg1 arg1, Arg2 arg2, Arg3 arg3)
     {
-        async_task::connect(handler_, arg1, arg2, arg3, thread_id_);
+        if (THIS_THREAD_ID() == thread_id_)
+            handler_(arg1, arg2, arg3);
+        else
+            async_task::connect(handler_, arg1, arg2, arg3, thread_id_);
     }
 
     template <typename Arg1, typename Arg2, typename Arg3, typename Arg4>
     void operator()(Arg1 arg1, Arg2 arg2, Arg3 arg3, Arg4 arg4)
     {
-        async_task::connect(handler_, arg1, arg2, arg3, arg4, thread_id_);
+        if (THIS_THREAD_ID() == thread_id_)
+            handler_(arg1, arg2, arg3, arg4);
+        else
+            async_task::connect(handler_, arg1, arg2, arg3, arg4, thread_id_);
     }
 
     template <typename Arg1, typename Arg2, typename Arg3, typename Arg4, typename Arg5>
     void operator()(Arg1 arg1, Arg2 arg2, Arg3 arg3, Arg4 arg4, Arg5 arg5)
     {
-        async_task::connect(handler_, arg1, arg2, arg3, arg4, arg5, thread_id_);
+        if (THIS_THREAD_ID() == thread_id_)
+            handler_(arg1, arg2, arg3, arg4, arg5);
+        else
+            async_task::connect(handler_, arg1, arg2, arg3, arg4, arg5, thread_id_);
     }
 
     /// Asio hook for handler allocation
@@ -109,10 +233,10 @@ public:
     }
 
     /// Asio hook for handler deallocation
-    friend void asio_handler_deallocate(void* pointer, std::size_t /*size*/,
+    friend void asio_handler_deallocate(void* pointer, std::size_t size,
                                         asio_handler_dispatcher<Handler, Allocator>* this_handler)
     {
-        this_handler->allocator_.deallocate(pointer);
+        this_handler->allocator_.deallocate(pointer, size);
     }
 
 private:
@@ -0,0 +1,213 @@
+//
+// header_scanner.cpp
+// Copyright (C) 2015  Emil Penchev, Bulgaria
+
+#include "header_scanner.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#if defined(__SSE2__)
+#define SNODE_SCAN_SSE2 1
+#include <emmintrin.h>
+#endif
+#if defined(__GNUC__)
+#define SNODE_SCAN_AVX2 1
+#include <immintrin.h>
+#endif
+#endif
+
+namespace snode
+{
+namespace http
+{
+
+namespace
+{
+    inline bool is_stop(unsigned char ch)
+    {
+        return (ch < 0x20 && ch != '\r' && ch != '\n') || ch >= 0x80;
+    }
+
+    /// Scalar state machine from "none" state starting at pos, used for the tails of the SIMD scanners as well.
+    header_scan scan_scalar(const char* data, size_t pos, size_t size)
+    {
+        // number of "\r\n\r\n" characters matched so far
+        size_t matched = 0;
+        size_t excluded = pos;
+        for (; pos < size; pos++)
+        {
+            unsigned char ch = static_cast<unsigned char>(data[pos]);
+            if ('\r' == ch)
+            {
+                if (2 == matched)
+                {
+                    matched = 3;
+                }
+                else
+                {
+                    excluded = pos;
+                    matched = 1;
+                }
+            }
+            else if ('\n' == ch)
+            {
+                if (1 == matched)
+                {
+                    matched = 2;
+                }
+                else if (3 == matched)
+                {
+                    header_scan result = { pos + 1, true };
+                    return result;
+                }
+                else
+                {
+                    matched = 0;
+                }
+            }
+            else if (is_stop(ch))
+            {
+                header_scan result = { pos + 1, true };
+                return result;
+            }
+            else
+            {
+                matched = 0;
+            }
+
+            if (!matched)
+                excluded = pos + 1;
+        }
+
+        header_scan result = { excluded, false };
+        return result;
+    }
+
+    inline unsigned first_bit(unsigned mask)
+    {
+        return static_cast<unsigned>(__builtin_ctz(mask));
+    }
+
+    /// Both vector scanners test a block of start positions at once: stop bytes are the signed bytes below 0x20
+    /// except CR and LF, terminators are found by comparing four loads shifted by one byte.
+    /// Start positions near the end, whose terminator would not fit in the loads, are left to the scalar scanner.
+    /// Any terminator starting before the tail has already been checked, so the scalar one starts from a clean state.
+#if defined(SNODE_SCAN_SSE2)
+    header_scan scan_sse2(const char* data, size_t size)
+    {
+        const __m128i cr = _mm_set1_epi8('\r');
+        const __m128i lf = _mm_set1_epi8('\n');
+        const __m128i space = _mm_set1_epi8(0x20);
+
+        size_t pos = 0;
+        for (; pos + 16 + 3 <= size; pos += 16)
+        {
+            const char* p = data + pos;
+            __m128i b0 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p));
+            __m128i b1 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p + 1));
+            __m128i b2 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p + 2));
+            __m128i b3 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p + 3));
+
+            __m128i is_cr = _mm_cmpeq_epi8(b0, cr);
+            __m128i eol = _mm_or_si128(is_cr, _mm_cmpeq_epi8(b0, lf));
+            __m128i stop = _mm_andnot_si128(eol, _mm_cmplt_epi8(b0, space));
+            __m128i term = _mm_and_si128(_mm_and_si128(is_cr, _mm_cmpeq_epi8(b1, lf)),
+                                         _mm_and_si128(_mm_cmpeq_epi8(b2, cr), _mm_cmpeq_epi8(b3, lf)));
+
+            unsigned stop_mask = static_cast<unsigned>(_mm_movemask_epi8(stop));
+            unsigned term_mask = static_cast<unsigned>(_mm_movemask_epi8(term));
+            if (stop_mask | term_mask)
+            {
+                unsigned stop_at = stop_mask ? first_bit(stop_mask) : 32;
+                unsigned term_at = term_mask ? first_bit(term_mask) : 32;
+                header_scan result = { pos + (stop_at < term_at ? stop_at + 1 : term_at + 4), true };
+                return result;
+            }
+        }
+        return scan_scalar(data, pos, size);
+    }
+#endif
+
+#if defined(SNODE_SCAN_AVX2)
+    __attribute__((target("avx2")))
+    header_scan scan_avx2(const char* data, size_t size)
+    {
+        const __m256i cr = _mm256_set1_epi8('\r');
+        const __m256i lf = _mm256_set1_epi8('\n');
+        const __m256i space = _mm256_set1_epi8(0x20);
+
+        size_t pos = 0;
+        for (; pos + 32 + 3 <= size; pos += 32)
+        {
+            const char* p = data + pos;
+            __m256i b0 = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(p));
+            __m256i b1 = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(p + 1));
+            __m256i b2 = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(p + 2));
+            __m256i b3 = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(p + 3));
+
+            __m256i is_cr = _mm256_cmpeq_epi8(b0, cr);
+            __m256i eol = _mm256_or_si256(is_cr, _mm256_cmpeq_epi8(b0, lf));
+            __m256i stop = _mm256_andnot_si256(eol, _mm256_cmpgt_epi8(space, b0));
+            __m256i term = _mm256_and_si256(_mm256_and_si256(is_cr, _mm256_cmpeq_epi8(b1, lf)),
+                                            _mm256_and_si256(_mm256_cmpeq_epi8(b2, cr), _mm256_cmpeq_epi8(b3, lf)));
+
+            unsigned stop_mask = static_cast<unsigned>(_mm256_movemask_epi8(stop));
+            unsigned term_mask = static_cast<unsigned>(_mm256_movemask_epi8(term));
+            if (stop_mask | term_mask)
+            {
+                unsigned stop_at = stop_mask ? first_bit(stop_mask) : 64;
+                unsigned term_at = term_mask ? first_bit(term_mask) : 64;
+                header_scan result = { pos + (stop_at < term_at ? stop_at + 1 : term_at + 4), true };
+                return result;
+            }
+        }
+        return scan_scalar(data, pos, size);
+    }
+#endif
+
+    typedef header_scan (*scan_func)(const char*, size_t);
+
+    struct scanner
+    {
+        scanner() : func_(&scan_header_end_scalar), name_("scalar")
+        {
+#if defined(SNODE_SCAN_SSE2)
+            func_ = &scan_sse2;
+            name_ = "sse2";
+#endif
+#if defined(SNODE_SCAN_AVX2)
+            __builtin_cpu_init();
+            if (__builtin_cpu_supports("avx2"))
+            {
+                func_ = &scan_avx2;
+                name_ = "avx2";
+            }
+#endif
+        }
+
+        scan_func func_;
+        const char* name_;
+    };
+
+    const scanner& get_scanner()
+    {
+        static const scanner s;
+        return s;
+    }
+}
+
+header_scan scan_header_end(const char* data, size_t size)
+{
+    return get_scanner().func_(data, size);
+}
+
+header_scan scan_header_end_scalar(const char* data, size_t size)
+{
+    return scan_scalar(data, 0, size);
+}
+
+const char* header_scanner_name()
+{
+    return get_scanner().name_;
+}
+
+}}
@@ -0,0 +1,36 @@
+//
+// header_scanner.h
+// Copyright (C) 2015  Emil Penchev, Bulgaria
+
+#ifndef HEADER_SCANNER_H_
+#define HEADER_SCANNER_H_
+
+#include <cstddef>
+
+namespace snode
+{
+namespace http
+{
+
+/// Result of a header terminator scan.
+struct header_scan
+{
+    size_t end_;    /// one past the match if found, otherwise the start of a possible partial "\r\n\r\n" at the end of the data
+    bool found_;    /// "\r\n\r\n" or a stop byte was found
+};
+
+/// Find the first "\r\n\r\n" or stop byte (control characters other than CR and LF, bytes above 127)
+/// in data, whichever comes first. A stop byte is taken as the end of the data,
+/// this prevents from hanging when a SSL client connects to the plain HTTP server.
+/// Uses the widest SIMD scanner supported by the CPU (AVX2, SSE2), selected once at runtime.
+header_scan scan_header_end(const char* data, size_t size);
+
+/// Byte at a time version of scan_header_end(), same semantics.
+header_scan scan_header_end_scalar(const char* data, size_t size);
+
+/// Name of the scanner used by scan_header_end() on this CPU ("avx2", "sse2" or "scalar").
+const char* header_scanner_name();
+
+}}
+
+#endif /* HEADER_SCANNER_H_ */
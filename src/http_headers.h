@@ -5,16 +5,20 @@
 #ifndef HTTP_HEADERS_H_
 #define HTTP_HEADERS_H_
 
-#include <map>
 #include <memory>
 #include <utility>
+#include <algorithm>
+#include <iterator>
 #include <cstring>
 #include <string>
 #include <vector>
 #include <sstream>
 #include <typeinfo>
+#include <boost/utility/string_ref.hpp>
 
 #include "utils.h"
+#include "http_parser.h"
+#include "slab_allocator.h"
 
 namespace snode
 {
@@ -22,147 +26,150 @@ namespace http
 {
 
 /// Represents HTTP headers, acts as a map.
+/// Fields are kept in a flat vector in insertion order, names and values are stored in a single arena per message.
+/// Well known names (http_constants.dat) are interned to a header_id and looked up through a direct index,
+/// other names are found by a case insensitive scan. Views returned by value() and by the iterators
+/// are valid until the headers are modified.
 class http_headers
 {
 public:
 
-    /// Function object to perform case insensitive comparison of wstrings.
-    struct case_insensitive_cmp_
+    typedef boost::string_ref key_type;
+    typedef std::size_t size_type;
+    typedef std::pair<boost::string_ref, boost::string_ref> value_type;
+
+    /// Iterates the header fields in insertion order, yields (name, value) pairs of views.
+    class const_iterator : public std::iterator<std::forward_iterator_tag, value_type>
     {
-        bool operator()(const std::string& str1, const std::string& str2) const
+    public:
+        const_iterator() : headers_(nullptr), pos_(0) {}
+
+        value_type operator*() const
         {
-#ifdef _WIN32
-            return _wcsicmp(str1.c_str(), str2.c_str()) < 0;
-#else
-            return utility::cmp::icmp(str1, str2) < 0;
-#endif
+            return value_type(headers_->name_at(pos_), headers_->value_at(pos_));
         }
-    };
 
-    typedef std::map<std::string, std::string, case_insensitive_cmp_> headers_map;
-    typedef std::map<std::string, std::string, case_insensitive_cmp_>::key_type key_type;
-    typedef std::map<std::string, std::string, case_insensitive_cmp_>::key_compare key_compare;
-    typedef std::map<std::string, std::string, case_insensitive_cmp_>::size_type size_type;
-    typedef std::map<std::string, std::string, case_insensitive_cmp_>::iterator iterator;
-    typedef std::map<std::string, std::string, case_insensitive_cmp_>::const_iterator const_iterator;
+        const_iterator& operator++()
+        {
+            pos_++;
+            return *this;
+        }
 
-    /// Constructs an empty set of HTTP headers.
-    http_headers() {}
+        const_iterator operator++(int)
+        {
+            const_iterator tmp(*this);
+            pos_++;
+            return tmp;
+        }
 
-    /// Copy constructor.
-    http_headers(const http_headers &other) : headers_(other.headers_) {}
+        bool operator==(const const_iterator& other) const { return pos_ == other.pos_; }
+        bool operator!=(const const_iterator& other) const { return pos_ != other.pos_; }
 
-    /// Assignment operator.
-    http_headers &operator=(const http_headers &other)
-    {
-        if (this != &other)
-            headers_ = other.headers_;
-        return *this;
-    }
+    private:
+        friend class http_headers;
+        const_iterator(const http_headers* headers, size_t pos) : headers_(headers), pos_(pos) {}
+
+        const http_headers* headers_;
+        size_t pos_;
+    };
 
-    /// Move constructor.
-    http_headers(http_headers &&other) : headers_(std::move(other.headers_)) {}
+    typedef const_iterator iterator;
 
-    /// Move assignment operator.
-    http_headers &operator=(http_headers &&other)
+    /// Constructs an empty set of HTTP headers.
+    http_headers() : garbage_(0)
     {
-        if(this != &other)
-            headers_ = std::move(other.headers_);
-        return *this;
+        std::fill(index_, index_ + s_known_count, 0);
     }
 
-
     /// Adds a header field with name (name) and value of the header (value).
     /// If the header field exists, the value will be combined as comma separated string.
     template<typename T>
-    void add(const key_type& name, const T& value)
+    void add(key_type name, const T& value)
     {
-        if (has(name))
-            headers_[name] =  headers_[name].append(", " + utility::conversions::print_string(value));
-        else
-            headers_[name] = utility::conversions::print_string(value);
+        add(name, boost::string_ref(utility::conversions::print_string(value)));
     }
 
+    void add(key_type name, const std::string& value) { add(name, boost::string_ref(value)); }
+    void add(key_type name, const char* value) { add(name, boost::string_ref(value)); }
+    void add(key_type name, boost::string_ref value) { add(lookup(name), find_header(name), name, value); }
+    void add(header_id id, boost::string_ref value) { add(lookup(id), id, header_name(id), value); }
+
+    /// Sets a header field, replacing the value if the field exists.
+    void set(key_type name, boost::string_ref value) { set(lookup(name), find_header(name), name, value); }
+    void set(header_id id, boost::string_ref value) { set(lookup(id), id, header_name(id), value); }
+
     /// Removes a header field.
-    void remove(const key_type& name)
-    {
-        headers_.erase(name);
-    }
+    void remove(key_type name) { remove_at(lookup(name)); }
+    void remove(header_id id) { remove_at(lookup(id)); }
 
     /// Removes all elements from the headers.
     void clear()
     {
-        headers_.clear();
+        fields_.clear();
+        arena_.clear();
+        garbage_ = 0;
+        std::fill(index_, index_ + s_known_count, 0);
     }
 
     /// Checks if there is a header with the given key.
     /// returns true if there is a header with the given name, false otherwise.
-    bool has(const key_type& name) const
-    {
-        return headers_.find(name) != headers_.end();
-    }
+    bool has(key_type name) const { return lookup(name) != s_npos; }
+    bool has(header_id id) const { return lookup(id) != s_npos; }
 
     /// Returns the number of header fields.
     size_type size() const
     {
-        return headers_.size();
+        return fields_.size();
     }
 
     /// Tests to see if there are any header fields.
     /// returns true if there are no headers, false otherwise.
     bool empty() const
     {
-        return headers_.empty();
+        return fields_.empty();
     }
 
-    /// Returns a reference to header field with given name, if there is no header field one is inserted.
-    std::string& operator[](const key_type &name)
+    /// Returns the value of the header field with given name, an empty view if there is no such field.
+    boost::string_ref value(key_type name) const
     {
-        return headers_[name];
+        size_t pos = lookup(name);
+        return s_npos == pos ? boost::string_ref() : value_at(pos);
+    }
+
+    boost::string_ref value(header_id id) const
+    {
+        size_t pos = lookup(id);
+        return s_npos == pos ? boost::string_ref() : value_at(pos);
     }
 
     /// Checks if a header field exists with given name and returns an iterator if found. Otherwise
     /// and iterator to end is returned.
     /// returns an iterator to where the HTTP header is found.
-    iterator find(const key_type& name)
+    const_iterator find(key_type name) const
     {
-        return headers_.find(name);
+        size_t pos = lookup(name);
+        return const_iterator(this, s_npos == pos ? fields_.size() : pos);
     }
 
-    const_iterator find(const key_type& name) const
+    /// Attempts to match a header field with the given name using the '>>' operator.
+    /// returns true if header field was found and successfully stored in value parameter.
+    template<typename T>
+    bool match(key_type name, T& value) const
     {
-        return headers_.find(name);
+        return match_at(lookup(name), value);
     }
 
-    /// Attempts to match a header field with the given name using the '>>' operator.
-    /// returns true if header field was found and successfully stored in value parameter.
     template<typename T>
-    bool match(const key_type& name, T& value) const
+    bool match(header_id id, T& value) const
     {
-        headers_map::const_iterator iter = headers_.find(name);
-        if (iter != headers_.end())
-        {
-            // Check to see if doesn't have a value.
-            if (iter->second.empty())
-            {
-                bind_impl(iter->second, value);
-                return true;
-            }
-            return bind_impl(iter->second, value);
-        }
-        else
-        {
-            return false;
-        }
+        return match_at(lookup(id), value);
     }
 
     /// Returns an iterator referring to the first header field (beginning of the HTTP headers).
-    iterator begin() { return headers_.begin(); }
-    const_iterator begin() const { return headers_.begin(); }
+    const_iterator begin() const { return const_iterator(this, 0); }
 
     /// Returns an iterator referring to the past-the-end header field.
-    iterator end() { return headers_.end(); }
-    const_iterator end() const { return headers_.end(); }
+    const_iterator end() const { return const_iterator(this, fields_.size()); }
 
     /// Gets the content length of the message.
     std::size_t content_length() const;
@@ -190,10 +197,243 @@ public:
 
 private:
 
+    static const size_t s_npos = static_cast<size_t>(-1);
+    static const size_t s_known_count = static_cast<size_t>(header_id::unknown);
+    static const size_t s_arena_reserve = 512;
+
+    struct field
+    {
+        header_id id_;
+        uint32_t name_;         // arena offset, unused for well known names
+        uint32_t name_size_;
+        uint32_t value_;        // arena offset
+        uint32_t value_size_;
+    };
+
+    boost::string_ref name_at(size_t pos) const
+    {
+        const field& f = fields_[pos];
+        if (f.id_ != header_id::unknown)
+            return header_name(f.id_);
+        return boost::string_ref(arena_.data() + f.name_, f.name_size_);
+    }
+
+    boost::string_ref value_at(size_t pos) const
+    {
+        const field& f = fields_[pos];
+        return boost::string_ref(arena_.data() + f.value_, f.value_size_);
+    }
+
+    size_t lookup(header_id id) const
+    {
+        if (header_id::unknown == id)
+            return s_npos;
+        return index_[static_cast<size_t>(id)] ? index_[static_cast<size_t>(id)] - 1 : s_npos;
+    }
+
+    size_t lookup(key_type name) const
+    {
+        header_id id = find_header(name);
+        if (id != header_id::unknown)
+            return lookup(id);
+
+        for (size_t pos = 0; pos < fields_.size(); pos++)
+        {
+            const field& f = fields_[pos];
+            if (header_id::unknown == f.id_ && f.name_size_ == name.size() && iequal(arena_.data() + f.name_, name.data(), name.size()))
+                return pos;
+        }
+        return s_npos;
+    }
+
+    void add(size_t pos, header_id id, key_type name, boost::string_ref value)
+    {
+        if (s_npos == pos)
+        {
+            insert(id, name, value);
+            return;
+        }
+
+        field& f = fields_[pos];
+        if (!f.value_size_)
+        {
+            set(pos, id, name, value);
+            return;
+        }
+
+        if (aliases(value))
+        {
+            std::string copy(value.data(), value.size());
+            add(pos, id, name, boost::string_ref(copy));
+            return;
+        }
+
+        // the combined value is written to the end of the arena, the old one becomes garbage
+        size_t old_value = f.value_, old_size = f.value_size_;
+        size_t offset = reserve(old_size + 2 + value.size());
+        arena_.resize(offset + old_size + 2 + value.size());
+        std::copy(arena_.begin() + old_value, arena_.begin() + old_value + old_size, arena_.begin() + offset);
+        arena_[offset + old_size] = ',';
+        arena_[offset + old_size + 1] = ' ';
+        std::copy(value.begin(), value.end(), arena_.begin() + offset + old_size + 2);
+        garbage_ += old_size;
+        f.value_ = static_cast<uint32_t>(offset);
+        f.value_size_ = static_cast<uint32_t>(old_size + 2 + value.size());
+    }
+
+    void remove_at(size_t pos)
+    {
+        if (s_npos == pos)
+            return;
+
+        garbage_ += fields_[pos].name_size_ + fields_[pos].value_size_;
+        fields_.erase(fields_.begin() + pos);
+        reindex();
+    }
+
+    void set(size_t pos, header_id id, key_type name, boost::string_ref value)
+    {
+        if (s_npos == pos)
+        {
+            insert(id, name, value);
+            return;
+        }
+
+        if (aliases(value))
+        {
+            std::string copy(value.data(), value.size());
+            set(pos, id, name, boost::string_ref(copy));
+            return;
+        }
+
+        field& f = fields_[pos];
+        if (value.size() <= f.value_size_)
+        {
+            // reuse the old value bytes
+            std::copy(value.begin(), value.end(), arena_.begin() + f.value_);
+            garbage_ += f.value_size_ - value.size();
+        }
+        else
+        {
+            garbage_ += f.value_size_;
+            f.value_ = static_cast<uint32_t>(append(value));
+        }
+        f.value_size_ = static_cast<uint32_t>(value.size());
+    }
+
+    void insert(header_id id, key_type name, boost::string_ref value)
+    {
+        if (aliases(name) || aliases(value))
+        {
+            std::string name_copy(name.data(), name.size()), value_copy(value.data(), value.size());
+            insert(id, boost::string_ref(name_copy), boost::string_ref(value_copy));
+            return;
+        }
+
+        if (garbage_ > s_arena_reserve && garbage_ * 2 > arena_.size())
+            compact();
+        if (arena_.empty())
+            arena_.reserve(s_arena_reserve);
+
+        field f;
+        f.id_ = id;
+        f.name_ = 0;
+        f.name_size_ = 0;
+        if (header_id::unknown == id)
+        {
+            f.name_ = static_cast<uint32_t>(append(name));
+            f.name_size_ = static_cast<uint32_t>(name.size());
+        }
+        f.value_ = static_cast<uint32_t>(append(value));
+        f.value_size_ = static_cast<uint32_t>(value.size());
+        fields_.push_back(f);
+
+        if (id != header_id::unknown)
+            index_[static_cast<size_t>(id)] = static_cast<uint16_t>(fields_.size());
+    }
+
+    /// Check if text is a view into the arena, which may move when the arena grows.
+    bool aliases(boost::string_ref text) const
+    {
+        return !arena_.empty() && text.data() >= arena_.data() && text.data() < arena_.data() + arena_.size();
+    }
+
+    size_t reserve(size_t size)
+    {
+        if (arena_.capacity() < arena_.size() + size)
+            arena_.reserve(std::max(arena_.capacity() * 2, arena_.size() + size));
+        return arena_.size();
+    }
+
+    size_t append(boost::string_ref text)
+    {
+        size_t offset = reserve(text.size());
+        arena_.insert(arena_.end(), text.begin(), text.end());
+        return offset;
+    }
+
+    /// Drop the bytes of replaced and removed values from the arena.
+    void compact()
+    {
+        arena_type arena;
+        arena.reserve(arena_.size() - garbage_);
+        for (auto& f : fields_)
+        {
+            if (header_id::unknown == f.id_)
+            {
+                size_t name = arena.size();
+                arena.insert(arena.end(), arena_.begin() + f.name_, arena_.begin() + f.name_ + f.name_size_);
+                f.name_ = static_cast<uint32_t>(name);
+            }
+            size_t value = arena.size();
+            arena.insert(arena.end(), arena_.begin() + f.value_, arena_.begin() + f.value_ + f.value_size_);
+            f.value_ = static_cast<uint32_t>(value);
+        }
+        arena_.swap(arena);
+        garbage_ = 0;
+    }
+
+    void reindex()
+    {
+        std::fill(index_, index_ + s_known_count, 0);
+        for (size_t pos = 0; pos < fields_.size(); pos++)
+        {
+            if (fields_[pos].id_ != header_id::unknown)
+                index_[static_cast<size_t>(fields_[pos].id_)] = static_cast<uint16_t>(pos + 1);
+        }
+    }
+
+    static bool iequal(const char* a, const char* b, size_t size)
+    {
+        for (size_t i = 0; i < size; i++)
+        {
+            char l = (a[i] >= 'A' && a[i] <= 'Z') ? static_cast<char>(a[i] - 'A' + 'a') : a[i];
+            char r = (b[i] >= 'A' && b[i] <= 'Z') ? static_cast<char>(b[i] - 'A' + 'a') : b[i];
+            if (l != r)
+                return false;
+        }
+        return true;
+    }
+
     template<typename T>
-    bool bind_impl(const key_type& text, T& ref) const
+    bool match_at(size_t pos, T& value) const
     {
-        std::istringstream iss(text);
+        if (s_npos == pos)
+            return false;
+
+        // Check to see if doesn't have a value.
+        if (!fields_[pos].value_size_)
+        {
+            bind_impl(value_at(pos), value);
+            return true;
+        }
+        return bind_impl(value_at(pos), value);
+    }
+
+    template<typename T>
+    bool bind_impl(boost::string_ref text, T& ref) const
+    {
+        std::istringstream iss(text.to_string());
         iss.imbue(std::locale::classic());
         iss >> ref;
         if (iss.fail() || !iss.eof())
@@ -202,14 +442,34 @@ private:
         return true;
     }
 
-    bool bind_impl(const key_type& text, std::string& ref) const
+    bool bind_impl(boost::string_ref text, std::string& ref) const
     {
-        ref = text;
+        ref.assign(text.data(), text.size());
         return true;
     }
 
-    // Headers are stored in a map with custom compare func object.
-    std::map<std::string, std::string, case_insensitive_cmp_> headers_;
+    bool bind_impl(boost::string_ref text, std::size_t& ref) const
+    {
+        if (text.empty())
+            return false;
+
+        std::size_t result = 0;
+        for (char ch : text)
+        {
+            if (ch < '0' || ch > '9' || result > (static_cast<std::size_t>(-1) - 9) / 10)
+                return false;
+            result = result * 10 + static_cast<std::size_t>(ch - '0');
+        }
+        ref = result;
+        return true;
+    }
+
+    typedef std::vector<char, pool_allocator<char> > arena_type;
+
+    std::vector<field, pool_allocator<field> > fields_;
+    arena_type arena_;
+    size_t garbage_;
+    uint16_t index_[s_known_count];    // position + 1 in fields_ of a well known field, 0 if absent
 };
 
 }}
@@ -180,6 +180,23 @@ namespace http
         return offset;
     }
 
+    size_t chunked_encoding::format_chunk_prefix(char* out, size_t chunk_size)
+    {
+        static const char digits[] = "0123456789ABCDEF";
+        char buffer[max_chunk_prefix];
+        size_t pos = sizeof(buffer) - 2;
+        buffer[pos] = '\r'; buffer[pos + 1] = '\n';
+        do
+        {
+            buffer[--pos] = digits[chunk_size & 0xF];
+            chunk_size >>= 4;
+        } while (chunk_size);
+
+        size_t size = sizeof(buffer) - pos;
+        memcpy(out, buffer + pos, size);
+        return size;
+    }
+
 #if (!defined(_WIN32) || defined(__cplusplus_winrt))
     const std::array<bool,128> valid_chars =
     {{
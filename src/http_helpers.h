@@ -69,6 +69,17 @@ namespace http
         // delimiters.
         //
         size_t add_chunked_delimiters(uint8_t* data, size_t buffer_size, size_t bytes_read);
+
+        // Longest chunk size line, the size in hex and CRLF.
+        static const size_t max_chunk_prefix = 2 * sizeof(size_t) + 2;
+
+        // Write the size line of a chunk with chunk_size bytes of data to out (at least max_chunk_prefix bytes),
+        // for sending the chunk data from its own buffer. Returns the number of characters written.
+        size_t format_chunk_prefix(char* out, size_t chunk_size);
+
+        // The CRLF after the chunk data and the last chunk with an empty trailer.
+        static const char chunk_suffix[] = "\r\n";
+        static const char last_chunk[] = "0\r\n\r\n";
     }
 }}
 
@@ -8,6 +8,11 @@
 
 #include <limits>
 #include <stdexcept>
+#include <fcntl.h>
+#include <poll.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/sendfile.h>
 
 namespace snode
 {
@@ -18,60 +23,53 @@ namespace http
 
 static void set_content_type_if_not_present(http::http_headers& headers, const std::string& content_type)
 {
-    std::string temp;
-    if (!headers.match(http::header_names::content_type, temp))
+    if (!headers.has(header_id::content_type))
     {
-        headers.add(http::header_names::content_type, content_type);
+        headers.add(header_id::content_type, content_type);
     }
 }
 
 std::string http_headers::content_type() const
 {
-    std::string result;
-    match(http::header_names::content_type, result);
-    return result;
+    return value(header_id::content_type).to_string();
 }
 
 void http_headers::set_content_type(const std::string& type)
 {
-    headers_[http::header_names::content_type] = type;
+    set(header_id::content_type, type);
 }
 
 std::string http_headers::cache_control() const
 {
-    std::string result;
-    match(http::header_names::cache_control, result);
-    return result;
+    return value(header_id::cache_control).to_string();
 }
 
 void http_headers::set_cache_control(const std::string& control)
 {
-    add(http::header_names::cache_control, control);
+    add(header_id::cache_control, control);
 }
 
 std::string http_headers::date() const
 {
-    std::string result;
-    match(http::header_names::date, result);
-    return result;
+    return value(header_id::date).to_string();
 }
 
 void http_headers::set_date()
 {
-    headers_[http::header_names::date] = utility::details::current_date_time();
+    set(header_id::date, utility::details::current_date_time());
 }
 
 
 std::size_t http_headers::content_length() const
 {
     std::size_t length = 0;
-    match(http::header_names::content_length, length);
+    match(header_id::content_length, length);
     return length;
 }
 
 void http_headers::set_content_length(std::size_t length)
 {
-    headers_[http::header_names::content_length] = utility::conversions::print_string(length);
+    set(header_id::content_length, utility::conversions::print_string(length));
 }
 
 static const std::string stream_was_set_explicitly = ("A stream was set on the message and extraction is not possible");
@@ -348,6 +346,52 @@ void http_request_impl::response_send_complete(http::error_code& err)
     }
 }
 
+file_body::file_body(int fd, std::size_t offset, std::size_t length)
+    : fd_(fd), offset_(static_cast<off_t>(offset)), length_(length), pipe_(false)
+{
+    struct stat st;
+    if (fd < 0 || fstat(fd, &st) < 0)
+    {
+        // the descriptor is owned from the start, the destructor does not run
+        if (fd >= 0)
+            ::close(fd);
+        throw std::invalid_argument("file body needs an open file descriptor");
+    }
+    pipe_ = S_ISFIFO(st.st_mode);
+}
+
+file_body::~file_body()
+{
+    ::close(fd_);
+}
+
+ssize_t file_body::transfer_to(int out_fd, std::size_t count)
+{
+    if (pipe_)
+        return splice(fd_, nullptr, out_fd, nullptr, count, SPLICE_F_MOVE | SPLICE_F_NONBLOCK | SPLICE_F_MORE);
+
+    // sendfile advances offset_
+    return sendfile(out_fd, fd_, &offset_, count);
+}
+
+bool file_body::source_empty() const
+{
+    if (!pipe_)
+        return false;
+
+    // a closed write end (POLLHUP) is not empty, the next splice() reports the end of the data
+    struct pollfd pfd = { fd_, POLLIN, 0 };
+    return poll(&pfd, 1, 0) == 0;
+}
+
+void http_response_impl::set_file_body(const std::shared_ptr<file_body>& body, const std::string& content_type)
+{
+    file_body_ = body;
+    headers().remove(header_id::transfer_encoding);
+    headers().set_content_length(body->length());
+    set_content_type_if_not_present(headers(), content_type);
+}
+
 #define _METHODS
 #define DAT(a,b) const method methods::a = b;
 #include "http_constants.dat"
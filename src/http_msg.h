@@ -20,6 +20,7 @@
 #include "async_task.h"
 #include "producer_consumer_buf.h"
 #include "container_buffer.h"
+#include "slab_allocator.h"
 
 namespace snode
 {
@@ -260,6 +261,39 @@ protected:
 };
 
 
+/// Response body sent from a file descriptor by the kernel, sendfile(2) for files and splice(2) for pipes,
+/// the data never passes through user space. Owns the descriptor and closes it on destruction.
+class file_body
+{
+public:
+    file_body(int fd, std::size_t offset, std::size_t length);
+    ~file_body();
+
+    file_body(const file_body&) = delete;
+    file_body& operator=(const file_body&) = delete;
+
+    std::size_t length() const { return length_; }
+
+    bool is_pipe() const { return pipe_; }
+
+    int fd() const { return fd_; }
+
+    /// Sends up to (count) bytes from the current position to the socket (out_fd).
+    /// Returns the number of bytes sent, 0 at the end of the file or -1 with errno set as the system calls do.
+    /// Reading a pipe does not block, EAGAIN comes from an empty pipe as well as from a full socket.
+    ssize_t transfer_to(int out_fd, std::size_t count);
+
+    /// Checks whether a pipe has nothing to read yet, tells an empty pipe from a full socket after EAGAIN.
+    /// Always false for files.
+    bool source_empty() const;
+
+private:
+    int fd_;
+    off_t offset_;
+    std::size_t length_;
+    bool pipe_;
+};
+
 /// Internal representation of an HTTP response.
 class http_response_impl : public http::http_msg_base
 {
@@ -278,10 +312,16 @@ public:
 
     std::string to_string() const;
 
+    /// Sets a body sent from a file descriptor and the "Content-Length" and "Content-Type" headers.
+    void set_file_body(const std::shared_ptr<file_body>& body, const std::string& content_type);
+
+    const std::shared_ptr<file_body>& get_file_body() const { return file_body_; }
+
 private:
 
     http::status_code status_code_;
     http::reason_phrase reason_phrase_;
+    std::shared_ptr<file_body> file_body_;
 };
 
 
@@ -291,10 +331,10 @@ class http_response
 public:
 
     /// Constructs a response with an empty status code, no headers, and no body.
-    http_response() : impl_(std::make_shared<http::http_response_impl>()) { }
+    http_response() : impl_(std::allocate_shared<http::http_response_impl>(pool_allocator<http::http_response_impl>())) { }
 
     /// Constructs a response with given status code, no headers, and no body.
-    http_response(http::status_code code) : impl_(std::make_shared<http::http_response_impl>(code)) { }
+    http_response(http::status_code code) : impl_(std::allocate_shared<http::http_response_impl>(pool_allocator<http::http_response_impl>(), code)) { }
 
     /// Gets the status code of the response message.
     http::status_code status_code() const { return impl_->status_code(); }
@@ -413,6 +453,15 @@ public:
         impl_->set_body(stream, content_type);
     }
 
+    /// Sets the body of the message to (length) bytes read from the file descriptor (fd) starting at (offset),
+    /// they are sent with sendfile(2), or splice(2) if (fd) is a pipe, without copying them to user space.
+    /// The response takes ownership of (fd) and closes it when it is no longer needed.
+    /// This cannot be used in conjunction with any other means of setting the body of the response.
+    void set_file_body(int fd, std::size_t offset, std::size_t length, const std::string& content_type = "application/octet-stream")
+    {
+        impl_->set_file_body(std::make_shared<http::file_body>(fd, offset, length), content_type);
+    }
+
     /// Defines a stream that will be relied on to provide the body of the HTTP message when it is sent.
     /// (stream) - A readable, open asynchronous stream.
     /// (content_length) - The size of the data to be sent in the body.
@@ -587,10 +636,10 @@ class http_request
 public:
 
     /// Constructs a new HTTP request with the 'GET' method.
-    http_request() : impl_(std::make_shared<http::http_request_impl>(http::methods::GET)) {}
+    http_request() : impl_(std::allocate_shared<http::http_request_impl>(pool_allocator<http::http_request_impl>(), http::methods::GET)) {}
 
     /// Constructs a new HTTP request with the given request method.
-    http_request(http::method mtd) : impl_(std::make_shared<http::http_request_impl>(std::move(mtd))) {}
+    http_request(http::method mtd) : impl_(std::allocate_shared<http::http_request_impl>(pool_allocator<http::http_request_impl>(), std::move(mtd))) {}
 
     /// Get the method (GET/PUT/POST/DELETE) of the request message.
     const http::method& method() const { return impl_->method(); }
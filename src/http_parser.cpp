@@ -0,0 +1,374 @@
+//
+// http_parser.cpp
+// Copyright (C) 2015  Emil Penchev, Bulgaria
+
+#include "http_parser.h"
+
+#include <cstring>
+
+namespace snode
+{
+namespace http
+{
+
+namespace
+{
+    // character classes
+    const uint8_t s_token = 1;  // tchar, RFC 7230 3.2.6
+    const uint8_t s_text = 2;   // visible characters, obs-text, space and tab (field value / request target)
+
+    struct char_table
+    {
+        char_table()
+        {
+            for (int ch = 0; ch < 256; ch++)
+            {
+                uint8_t cls = 0;
+                if ((ch > 32 && ch < 127) || ch >= 128 || ch == ' ' || ch == '\t')
+                    cls |= s_text;
+                if ((ch >= '0' && ch <= '9') || (ch >= 'a' && ch <= 'z') || (ch >= 'A' && ch <= 'Z') ||
+                    (ch && std::strchr("!#$%&'*+-.^_`|~", ch)))
+                    cls |= s_token;
+                class_[ch] = cls;
+                lower_[ch] = (ch >= 'A' && ch <= 'Z') ? static_cast<char>(ch + ('a' - 'A')) : static_cast<char>(ch);
+            }
+        }
+
+        uint8_t class_[256];
+        char lower_[256];
+    };
+
+    const char_table s_chars;
+
+    inline bool is_token(char ch) { return s_chars.class_[static_cast<uint8_t>(ch)] & s_token; }
+    inline bool is_text(char ch) { return s_chars.class_[static_cast<uint8_t>(ch)] & s_text; }
+    inline char to_lower(char ch) { return s_chars.lower_[static_cast<uint8_t>(ch)]; }
+
+    bool iequal(const char* a, const char* b, size_t size)
+    {
+        for (size_t i = 0; i < size; i++)
+        {
+            if (to_lower(a[i]) != to_lower(b[i]))
+                return false;
+        }
+        return true;
+    }
+
+    /// Open addressing hash of constant tokens, built once from http_constants.dat.
+    /// Lookup is case insensitive and hashes only the length and the first and the last character.
+    template<typename Id, size_t Slots>
+    class token_table
+    {
+    public:
+        token_table(const char* const* names, size_t count)
+        {
+            for (size_t i = 0; i < Slots; i++)
+                slots_[i] = nullptr;
+
+            for (size_t i = 0; i < count; i++)
+            {
+                entries_[i].name_ = names[i];
+                entries_[i].size_ = std::strlen(names[i]);
+                entries_[i].id_ = static_cast<Id>(i);
+
+                size_t slot = hash(entries_[i].name_, entries_[i].size_);
+                while (slots_[slot])
+                    slot = (slot + 1) % Slots;
+                slots_[slot] = &entries_[i];
+            }
+        }
+
+        Id find(boost::string_ref name) const
+        {
+            if (name.empty())
+                return Id::unknown;
+
+            for (size_t slot = hash(name.data(), name.size()); slots_[slot]; slot = (slot + 1) % Slots)
+            {
+                const entry* e = slots_[slot];
+                if (e->size_ == name.size() && iequal(e->name_, name.data(), name.size()))
+                    return e->id_;
+            }
+            return Id::unknown;
+        }
+
+        boost::string_ref name(Id id) const
+        {
+            const entry& e = entries_[static_cast<size_t>(id)];
+            return boost::string_ref(e.name_, e.size_);
+        }
+
+    private:
+
+        struct entry
+        {
+            const char* name_;
+            size_t size_;
+            Id id_;
+        };
+
+        static size_t hash(const char* name, size_t size)
+        {
+            size_t h = size * 31 + static_cast<uint8_t>(to_lower(name[0]));
+            h = h * 31 + static_cast<uint8_t>(to_lower(name[size - 1]));
+            return h % Slots;
+        }
+
+        entry entries_[static_cast<size_t>(Id::unknown)];
+        const entry* slots_[Slots];
+    };
+
+    const char* const s_method_names[] =
+    {
+#define _METHODS
+#define DAT(a,b) b,
+#include "http_constants.dat"
+#undef _METHODS
+#undef DAT
+    };
+
+    const char* const s_header_names[] =
+    {
+#define _HEADER_NAMES
+#define DAT(a,b) b,
+#include "http_constants.dat"
+#undef _HEADER_NAMES
+#undef DAT
+    };
+
+    typedef token_table<method_id, 31> method_table;
+    typedef token_table<header_id, 127> header_table;
+
+    const method_table& methods()
+    {
+        static const method_table table(s_method_names, sizeof(s_method_names) / sizeof(s_method_names[0]));
+        return table;
+    }
+
+    const header_table& headers()
+    {
+        static const header_table table(s_header_names, sizeof(s_header_names) / sizeof(s_header_names[0]));
+        return table;
+    }
+}
+
+method_id find_method(boost::string_ref name)
+{
+    return methods().find(name);
+}
+
+header_id find_header(boost::string_ref name)
+{
+    return headers().find(name);
+}
+
+boost::string_ref method_name(method_id id)
+{
+    return id == method_id::unknown ? boost::string_ref() : methods().name(id);
+}
+
+boost::string_ref header_name(header_id id)
+{
+    return id == header_id::unknown ? boost::string_ref() : headers().name(id);
+}
+
+void request_parser::reset()
+{
+    data_ = nullptr;
+    pos_ = mark_ = trail_ = 0;
+    state_ = state::line_start;
+    method_id_ = method_id::unknown;
+    method_.offset_ = method_.size_ = 0;
+    target_.offset_ = target_.size_ = 0;
+    version_major_ = version_minor_ = 0;
+    header_count_ = 0;
+}
+
+request_parser::result request_parser::parse(const char* data, size_t size)
+{
+    static const char s_version[] = "HTTP/";
+    static const size_t s_version_size = sizeof(s_version) - 1;
+
+    data_ = data;
+    if (state::failed == state_)
+        return error;
+    if (state::finished == state_)
+        return done;
+
+    while (pos_ < size)
+    {
+        char ch = data[pos_];
+        switch (state_)
+        {
+        case state::line_start:
+            // tolerate empty lines in front of the request line (RFC 7230 3.5)
+            if ('\r' == ch || '\n' == ch)
+                break;
+            if (!is_token(ch))
+                return fail();
+            mark_ = pos_;
+            state_ = state::method;
+            break;
+
+        case state::method:
+            if (' ' == ch)
+            {
+                method_.offset_ = static_cast<uint32_t>(mark_);
+                method_.size_ = static_cast<uint32_t>(pos_ - mark_);
+                method_id_ = find_method(view(method_));
+                mark_ = pos_ + 1;
+                state_ = state::target;
+            }
+            else if (!is_token(ch))
+            {
+                return fail();
+            }
+            break;
+
+        case state::target:
+            if (' ' == ch)
+            {
+                if (pos_ == mark_)
+                    return fail();
+                target_.offset_ = static_cast<uint32_t>(mark_);
+                target_.size_ = static_cast<uint32_t>(pos_ - mark_);
+                mark_ = pos_ + 1;
+                state_ = state::version;
+            }
+            else if (!is_text(ch) || '\t' == ch)
+            {
+                return fail();
+            }
+            break;
+
+        case state::version:
+            if (ch != s_version[pos_ - mark_])
+                return fail();
+            if (pos_ - mark_ + 1 == s_version_size)
+                state_ = state::version_major;
+            break;
+
+        case state::version_major:
+            if (ch < '0' || ch > '9')
+                return fail();
+            version_major_ = ch - '0';
+            state_ = state::version_dot;
+            break;
+
+        case state::version_dot:
+            if ('.' != ch)
+                return fail();
+            state_ = state::version_minor;
+            break;
+
+        case state::version_minor:
+            if (ch < '0' || ch > '9')
+                return fail();
+            version_minor_ = ch - '0';
+            state_ = state::line_cr;
+            break;
+
+        case state::line_cr:
+            if ('\r' == ch)
+                state_ = state::line_lf;
+            else if ('\n' == ch)
+                state_ = state::header_start;
+            else
+                return fail();
+            break;
+
+        case state::line_lf:
+            if ('\n' != ch)
+                return fail();
+            state_ = state::header_start;
+            break;
+
+        case state::header_start:
+            if ('\r' == ch)
+            {
+                state_ = state::end_lf;
+            }
+            else if ('\n' == ch)
+            {
+                pos_++;
+                state_ = state::finished;
+                return done;
+            }
+            else if (is_token(ch))
+            {
+                if (s_max_headers == header_count_)
+                    return fail();
+                mark_ = pos_;
+                state_ = state::header_name;
+            }
+            else
+            {
+                // includes obsolete line folding (RFC 7230 3.2.4)
+                return fail();
+            }
+            break;
+
+        case state::header_name:
+            if (':' == ch)
+            {
+                header_span& h = headers_[header_count_];
+                h.name_.offset_ = static_cast<uint32_t>(mark_);
+                h.name_.size_ = static_cast<uint32_t>(pos_ - mark_);
+                h.id_ = find_header(view(h.name_));
+                state_ = state::value_start;
+            }
+            else if (!is_token(ch))
+            {
+                return fail();
+            }
+            break;
+
+        case state::value_start:
+            if (' ' == ch || '\t' == ch)
+                break;
+            mark_ = trail_ = pos_;
+            state_ = state::value;
+            // fall through
+
+        case state::value:
+            if ('\r' == ch || '\n' == ch)
+            {
+                header_span& h = headers_[header_count_++];
+                h.value_.offset_ = static_cast<uint32_t>(mark_);
+                h.value_.size_ = static_cast<uint32_t>(trail_ - mark_);
+                state_ = '\r' == ch ? state::value_lf : state::header_start;
+            }
+            else if (!is_text(ch))
+            {
+                return fail();
+            }
+            else if (' ' != ch && '\t' != ch)
+            {
+                trail_ = pos_ + 1;
+            }
+            break;
+
+        case state::value_lf:
+            if ('\n' != ch)
+                return fail();
+            state_ = state::header_start;
+            break;
+
+        case state::end_lf:
+            if ('\n' != ch)
+                return fail();
+            pos_++;
+            state_ = state::finished;
+            return done;
+
+        case state::finished:
+        case state::failed:
+            break;
+        }
+        pos_++;
+    }
+
+    return incomplete;
+}
+
+}}
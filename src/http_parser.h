@@ -0,0 +1,172 @@
+//
+// http_parser.h
+// Copyright (C) 2015  Emil Penchev, Bulgaria
+
+#ifndef HTTP_PARSER_H_
+#define HTTP_PARSER_H_
+
+#include <cstddef>
+#include <cstdint>
+#include <boost/utility/string_ref.hpp>
+
+namespace snode
+{
+namespace http
+{
+
+/// Ids of the standard HTTP methods, in the order of http_constants.dat.
+enum class method_id : uint8_t
+{
+#define _METHODS
+#define DAT(a,b) a,
+#include "http_constants.dat"
+#undef _METHODS
+#undef DAT
+    unknown
+};
+
+/// Ids of the well known header fields, in the order of http_constants.dat.
+enum class header_id : uint8_t
+{
+#define _HEADER_NAMES
+#define DAT(a,b) a,
+#include "http_constants.dat"
+#undef _HEADER_NAMES
+#undef DAT
+    unknown
+};
+
+/// Case insensitive lookup of a method token, returns method_id::unknown if it is not a standard one.
+method_id find_method(boost::string_ref name);
+
+/// Case insensitive lookup of a header field name, returns header_id::unknown if it is not a well known one.
+header_id find_header(boost::string_ref name);
+
+/// Canonical spelling of a standard method, as in http_constants.dat.
+boost::string_ref method_name(method_id id);
+
+/// Canonical spelling of a well known header field name, as in http_constants.dat.
+boost::string_ref header_name(header_id id);
+
+/// Incremental HTTP/1.x request line and header parser.
+/// Works directly on the receive buffer and never allocates, all parsed tokens are views into that buffer.
+/// parse() may be called again as more data arrives, it resumes where the previous call stopped.
+/// The buffer may be moved between calls (only its contents must be kept), the views returned
+/// by the accessors are valid until the next parse() call or until the buffer is changed.
+class request_parser
+{
+public:
+
+    /// Maximum number of header fields in a request, requests with more are rejected.
+    static const size_t s_max_headers = 64;
+
+    enum result
+    {
+        incomplete, /// need more data
+        done,       /// request line and all header fields are parsed
+        error       /// malformed request
+    };
+
+    /// Parsed header field.
+    struct field
+    {
+        header_id id_;
+        boost::string_ref name_;
+        boost::string_ref value_;
+    };
+
+    request_parser()
+    {
+        reset();
+    }
+
+    /// Prepare for a new request.
+    void reset();
+
+    /// Parse data, which is the whole unconsumed input since the start of the request.
+    result parse(const char* data, size_t size);
+
+    /// Number of bytes taken by the request line and the headers, including the terminating empty line.
+    size_t consumed() const { return pos_; }
+
+    method_id method() const { return method_id_; }
+    boost::string_ref method_name() const { return view(method_); }
+    boost::string_ref target() const { return view(target_); }
+    int version_major() const { return version_major_; }
+    int version_minor() const { return version_minor_; }
+
+    size_t header_count() const { return header_count_; }
+    field header(size_t index) const
+    {
+        field f;
+        f.id_ = headers_[index].id_;
+        f.name_ = view(headers_[index].name_);
+        f.value_ = view(headers_[index].value_);
+        return f;
+    }
+
+private:
+
+    enum class state : uint8_t
+    {
+        line_start,
+        method,
+        target,
+        version,
+        version_major,
+        version_dot,
+        version_minor,
+        line_cr,
+        line_lf,
+        header_start,
+        header_name,
+        value_start,
+        value,
+        value_lf,
+        end_lf,
+        finished,
+        failed
+    };
+
+    // token position relative to the start of the data
+    struct span
+    {
+        uint32_t offset_;
+        uint32_t size_;
+    };
+
+    struct header_span
+    {
+        header_id id_;
+        span name_;
+        span value_;
+    };
+
+    boost::string_ref view(const span& s) const
+    {
+        return boost::string_ref(data_ + s.offset_, s.size_);
+    }
+
+    result fail()
+    {
+        state_ = state::failed;
+        return error;
+    }
+
+    const char* data_;
+    size_t pos_;
+    size_t mark_;     // start of the token being parsed
+    size_t trail_;    // end of the header value without the trailing whitespace
+    state state_;
+    method_id method_id_;
+    span method_;
+    span target_;
+    int version_major_;
+    int version_minor_;
+    size_t header_count_;
+    header_span headers_[s_max_headers];
+};
+
+}}
+
+#endif /* HTTP_PARSER_H_ */
@@ -2,13 +2,19 @@
 // http_service.h
 // Copyright (C) 2015  Emil Penchev, Bulgaria
 
+#include <array>
+#include <cerrno>
+#include <cstring>
+#include <limits>
 #include <memory>
 #include <boost/type_traits.hpp>
 #include <boost/algorithm/string/find.hpp>
 #include <boost/bind.hpp>
+#include <boost/make_shared.hpp>
 
 #include "http_service.h"
 #include "http_helpers.h"
+#include "header_scanner.h"
 #include "http_msg.h"
 #include "async_task.h"
 #include "async_streams.h"
@@ -37,18 +43,6 @@ snode_core::service_factory::registrator<http_service_factory_wrapper> http_serv
 // http://www.boost.org/doc/libs/1_55_0/doc/html/boost_asio/reference/async_read_until/overload4.html
 struct crlf_nonascii_searcher_t
 {
-    enum class State
-    {
-        none = 0,   // ".\r\n\r\n$"
-        cr = 1,     // "\r.\n\r\n$"
-                    // "  .\r\n\r\n$"
-        crlf = 2,   // "\r\n.\r\n$"
-                    // "    .\r\n\r\n$"
-        crlfcr = 3  // "\r\n\r.\n$"
-                    // "    \r.\n\r\n$"
-                    // "      .\r\n\r\n$"
-    };
-
     // This function implements the searcher which "consumes" a certain amount of the input
     // and returns whether or not there was a match (see above).
 
@@ -58,69 +52,17 @@ struct crlf_nonascii_searcher_t
     //  calculate the begin parameter for any subsequent invocation of the match condition.
     //  The second member of the return value is true if a match has been found, false
     //  otherwise."
+    // In the case that we end inside a partially parsed match (like abcd\r\n\r),
+    // the matcher is given the partial match back again (\r\n\r) on the next call.
+    // The input of the request streambuf is a single contiguous buffer, so it is scanned in place by the SIMD scanner.
     template<typename Iter>
     std::pair<Iter, bool> operator()(const Iter begin, const Iter end) const
     {
-        // In the case that we end inside a partially parsed match (like abcd\r\n\r),
-        // we need to signal the matcher to give us the partial match back again (\r\n\r).
-        // We use the excluded variable to keep track of this sequence point (abcd.\r\n\r
-        // in the previous example).
-        Iter excluded = begin;
-        Iter cur = begin;
-        State state = State::none;
-        while (cur != end)
-        {
-            char c = *cur;
-            if (c == '\r')
-            {
-                if (state == State::crlf)
-                {
-                    state = State::crlfcr;
-                }
-                else
-                {
-                    // In the case of State::cr or State::crlfcr, setting the state here
-                    // "skips" a none state and therefore fails to move up the excluded
-                    // counter.
-                    excluded = cur;
-                    state = State::cr;
-                }
-            }
-            else if (c == '\n')
-            {
-                if (state == State::cr)
-                {
-                    state = State::crlf;
-                }
-                else if (state == State::crlfcr)
-                {
-                    ++cur;
-                    return std::make_pair(cur, true);
-                }
-                else
-                {
-                    state = State::none;
-                }
-            }
-            else if (c <= '\x1F' && c >= '\x00')
-            {
-                ++cur;
-                return std::make_pair(cur, true);
-            }
-            else if (c <= '\xFF' && c >= '\x80')
-            {
-                ++cur;
-                return std::make_pair(cur, true);
-            }
-            else
-            {
-                state = State::none;
-            }
-            ++cur;
-            if (state == State::none)
-                excluded = cur;
-        }
-        return std::make_pair(excluded, false);
+        if (begin == end)
+            return std::make_pair(begin, false);
+
+        header_scan result = scan_header_end(&*begin, static_cast<size_t>(end - begin));
+        return std::make_pair(begin + result.end_, result.found_);
     }
 } crlf_nonascii_searcher;
 }}
@@ -138,15 +80,57 @@ namespace snode
 namespace http
 {
 
-const size_t ChunkSize = 4 * 1024;
+// Content-Length value without allocating, false if it is not a plain decimal number.
+static bool parse_content_length(boost::string_ref value, size_t& length)
+{
+    if (value.empty())
+        return false;
+
+    size_t result = 0;
+    for (char ch : value)
+    {
+        if (ch < '0' || ch > '9' || result > (size_t(-1) - 9) / 10)
+            return false;
+        result = result * 10 + static_cast<size_t>(ch - '0');
+    }
+    length = result;
+    return true;
+}
 
-http_service::http_service()
+const char* http_service::s_max_chunk_option = "maxChunkSize";
+const char* http_service::s_chunk_memory_option = "maxChunkMemory";
+const char* http_service::s_body_buffer_high_option = "bodyBufferHigh";
+const char* http_service::s_body_buffer_low_option = "bodyBufferLow";
+
+// Size option value, false if it is not set or not a plain decimal number.
+static bool parse_size_option(const options_map_t& options, const char* name, size_t& size)
 {
+    auto it = options.find(name);
+    return it != options.end() && parse_content_length(it->second, size);
+}
+
+http_service::http_service() : body_buffer_high_(s_default_body_buffer_high), body_buffer_low_(s_default_body_buffer_low)
+{
+    for (const auto& config : snode_core::instance().get_config().services())
+    {
+        if (config.name != "http")
+            continue;
+
+        size_t max_chunk = chunk_sizer::max_chunk(), memory = chunk_sizer::s_default_memory_budget;
+        parse_size_option(config.options, s_max_chunk_option, max_chunk);
+        parse_size_option(config.options, s_chunk_memory_option, memory);
+        chunk_sizer::configure(max_chunk, memory);
+
+        parse_size_option(config.options, s_body_buffer_high_option, body_buffer_high_);
+        parse_size_option(config.options, s_body_buffer_low_option, body_buffer_low_);
+    }
+
     const std::vector<thread_ptr>& threads = snode_core::instance().get_threadpool().threads();
     std::set<std::string> handlers_list;
     req_handler_factory::get_reg_list(handlers_list);
 
-    // Setup request handlers for every thread
+    // Setup request handlers for every thread, indexed by the worker index
+    handlers_.resize(threads.size());
     for (auto name : handlers_list)
     {
         http_req_handler* req_handler = req_handler_factory::create_instance(name);
@@ -158,55 +142,66 @@ http_service::http_service()
             continue;
         }
 
-        for (auto thread_i : threads)
+        for (auto& router : handlers_)
         {
             if (nullptr == req_handler)
             {
                 req_handler = req_handler_factory::create_instance(name);
             }
 
-            if (handlers_.count(thread_i->get_id()) > 0)
+            // every URL path is handled from a unique handler, the first registered handler for a path wins
+            req_handler_ptr handler_ptr(req_handler);
+            for (auto url_path : paths)
             {
-                auto & handlers_map = handlers_[thread_i->get_id()];
-                for (auto url_path : paths)
-                {
-                    // every URL path is handled from a unique handler
-                    if (!handlers_map.count(url_path))
-                    {
-                        handlers_map[url_path] = req_handler_ptr(req_handler);
-                    }
-                }
-            }
-            else
-            {
-                std::map<std::string, req_handler_ptr> handlers_map;
-                for (auto url_path : paths)
-                {
-                    handlers_map[url_path] = req_handler_ptr(req_handler);
-                }
-
-                handlers_[thread_i->get_id()] = handlers_map;
+                router.add(url_path, handler_ptr);
             }
             // create new request handler object for each thread
             req_handler = nullptr;
         }
     }
+
+    for (auto& router : handlers_)
+    {
+        router.compile();
+    }
 }
 
 void http_service::accept(tcp_socket_ptr sock)
 {
-    auto listener = listeners_factory_.get_next_listener();
-    snode::async_task::connect(&net_service_listener_base::on_accept, listener, sock, listener->thread_id());
+    threadpool& pool = snode_core::instance().get_threadpool();
+
+    // in multi-reactor mode the socket is already bound to a worker's io_service, the connection must stay there.
+    auto listener = pool.multi_reactor() ? listeners_factory_.get_listener(pool.io_service_owner(sock->get_io_service()))
+                                         : listeners_factory_.get_next_listener();
+
+    // sharded acceptors complete on the listener's own worker, no need to schedule a task.
+    if (listener->thread_id() == THIS_THREAD_ID())
+        listener->on_accept(sock);
+    else
+        snode::async_task::connect(&net_service_listener_base::on_accept, listener, sock, listener->thread_id());
 }
 
-http_req_handler* http_service::get_req_handler(const std::string& url_path)
+void http_service::stop()
 {
-    return NULL;
+    listeners_factory_.stop();
+}
+
+http_req_handler* http_service::get_req_handler(boost::string_ref url)
+{
+    if (handlers_.empty())
+        return nullptr;
+
+    threadpool& pool = snode_core::instance().get_threadpool();
+    const path_router<req_handler_ptr>& router = handlers_[pool.is_worker() ? pool.current_worker() : 0];
+    const req_handler_ptr* handler = router.match(url);
+    return handler ? handler->get() : nullptr;
 }
 
 void http_listener::do_accept(tcp_socket_ptr sock)
 {
-    http_conn_ptr conn(new http_connection(sock, dynamic_cast<http_service*>(http_service::instance()), this, THIS_THREAD_ID()));
+    // connection memory comes from this worker's slab cache and is reused by the next accepted connection
+    http_conn_ptr conn = boost::allocate_shared<http_connection>(pool_allocator<http_connection>(), sock,
+                             dynamic_cast<http_service*>(http_service::instance()), this, THIS_THREAD_ID());
     connections_.insert(conn);
 }
 
@@ -216,6 +211,13 @@ void http_listener::drop_connection(http_conn_ptr conn)
     connections_.erase(conn);
 }
 
+void http_listener::do_stop()
+{
+    for (auto conn : connections_)
+        conn->close();
+    connections_.clear();
+}
+
 void http_connection::close()
 {
     close_ = true;
@@ -230,18 +232,67 @@ void http_connection::close()
     }
 }
 
-void http_connection::start_request_response()
+void http_connection::read_next_request()
 {
     read_size_ = 0;
     read_ = 0;
-    request_buf_.consume(request_buf_.size()); // clear the buffer
+    reading_ = true;
+    parser_.reset();
+    // fresh request state for every request on a keep-alive connection, the impl is recycled through the slab
+    request_ = http_request();
 
+    // Pipelined requests may be already in the buffer, the read completes then without touching the socket.
     // Wait for either double newline or a char which is not in the range [32-127] which suggests SSL handshaking.
     // For the SSL server support this line might need to be changed. Now, this prevents from hanging when SSL client tries to connect.
     async_read_until(*socket_, request_buf_, crlf_nonascii_searcher,
             ALLOC_HANDLER(boost::bind(&http_connection::handle_http_line, this, placeholders::error)));
 }
 
+void http_connection::request_read_done()
+{
+    reading_ = false;
+    if (closing_ || (read_closed_ && pipeline_.empty() && !writing_))
+    {
+        finish_request_response();
+    }
+    else if (!read_closed_ && pipeline_.size() < s_max_pipeline_depth)
+    {
+        // parse ahead, the request is handled while the next one is read
+        read_next_request();
+    }
+}
+
+void http_connection::stop_reading()
+{
+    reading_ = false;
+    read_closed_ = true;
+    // the pending responses are still written, the last one finishes the connection
+    if (closing_ || (pipeline_.empty() && !writing_))
+        finish_request_response();
+}
+
+void http_connection::reject_request()
+{
+    request_.reply_if_not_already(status_codes::BadRequest);
+    reading_ = false;
+    read_closed_ = true;
+    queue_request(true);
+}
+
+void http_connection::queue_request(bool bad_request)
+{
+    pipeline_.push_back(pending_request(request_, bad_request));
+    if (!writing_)
+        respond_to_next();
+}
+
+void http_connection::respond_to_next()
+{
+    writing_ = true;
+    pending_request& next = pipeline_.front();
+    next.request_.get_response(std::bind(&http_connection::handle_response, this, std::placeholders::_1, next.bad_request_));
+}
+
 void http_connection::handle_http_line(const boost::system::error_code& ec)
 {
     if (ec)
@@ -249,79 +300,26 @@ void http_connection::handle_http_line(const boost::system::error_code& ec)
         // client closed connection
         if (ec == boost::asio::error::eof || ec == boost::asio::error::operation_aborted)
         {
-            finish_request_response();
+            stop_reading();
         }
         else
         {
-            request_.reply_if_not_already(status_codes::BadRequest);
-            close_ = true;
-            do_response(true);
+            reject_request();
         }
     }
     else
     {
-        // read http status line
-        std::istream request_stream(&request_buf_);
-        request_stream.imbue(std::locale::classic());
-        std::skipws(request_stream);
-
-        std::string http_verb;
-        request_stream >> http_verb;
-
-        if (boost::iequals(http_verb, http::methods::GET))          http_verb = http::methods::GET;
-        else if (boost::iequals(http_verb, http::methods::POST))    http_verb = http::methods::POST;
-        else if (boost::iequals(http_verb, http::methods::PUT))     http_verb = http::methods::PUT;
-        else if (boost::iequals(http_verb, http::methods::DEL))     http_verb = http::methods::DEL;
-        else if (boost::iequals(http_verb, http::methods::HEAD))    http_verb = http::methods::HEAD;
-        else if (boost::iequals(http_verb, http::methods::TRACE))   http_verb = http::methods::TRACE;
-        else if (boost::iequals(http_verb, http::methods::CONNECT)) http_verb = http::methods::CONNECT;
-        else if (boost::iequals(http_verb, http::methods::OPTIONS)) http_verb = http::methods::OPTIONS;
-
-        // Check to see if there is not allowed character on the input
-        if (!validate_method(http_verb))
+        // parse request line and headers in place, the read above stops after the empty line terminating the headers
+        const char* data = boost::asio::buffer_cast<const char*>(request_buf_.data());
+        if (parser_.parse(data, request_buf_.size()) != request_parser::done)
         {
-            request_.reply_if_not_already(status_codes::BadRequest);
-            close_ = true;
-            do_response(true);
+            reject_request();
             return;
         }
 
-        request_.set_method(http_verb);
-
-        std::string http_path_and_version;
-        std::getline(request_stream, http_path_and_version);
-        const size_t VersionPortionSize = sizeof(" HTTP/1.1\r") - 1;
-
-        // Make sure path and version is long enough to contain the HTTP version
-        if (http_path_and_version.size() < VersionPortionSize + 2)
-        {
-            request_.reply_if_not_already(status_codes::BadRequest);
-            close_ = true;
-            do_response(true);
-            return;
-        }
-
-        // Get the path - remove the version portion and prefix space
-        try
-        {
-            request_.set_request_url(http_path_and_version.substr(1, http_path_and_version.size() - VersionPortionSize - 1));
-        }
-        catch (const std::exception& ex)
-        {
-            request_.reply_if_not_already(status_codes::BadRequest);
-            close_ = true;
-            do_response(true);
-            return;
-        }
-
-
-        // Get the version
-        std::string http_version = http_path_and_version.substr(http_path_and_version.size() - VersionPortionSize + 1, VersionPortionSize - 2);
-        // if HTTP version is 1.0 then disable pipelining
-        if (http_version == "HTTP/1.0")
-        {
-            close_ = true;
-        }
+        boost::string_ref verb = parser_.method() != method_id::unknown ? method_name(parser_.method()) : parser_.method_name();
+        request_.set_method(http::method(verb.data(), verb.size()));
+        request_.set_request_url(std::string(parser_.target().data(), parser_.target().size()));
 
         handle_headers();
     }
@@ -329,66 +327,65 @@ void http_connection::handle_http_line(const boost::system::error_code& ec)
 
 void http_connection::handle_headers()
 {
-    std::istream request_stream(&request_buf_);
-    request_stream.imbue(std::locale::classic());
-    std::string header;
+    bool has_length = false;
+    read_size_ = 0;
+    // if HTTP version is 1.0 then disable pipelining, this is the last request on the connection
+    if (parser_.version_major() < 1 || (parser_.version_major() == 1 && parser_.version_minor() == 0))
+        read_closed_ = true;
+    chunked_ = false;
 
-    while (std::getline(request_stream, header) && header != "\r")
+    http_headers& headers = request_.headers();
+    for (size_t i = 0; i < parser_.header_count(); i++)
     {
-        auto colon = header.find(':');
-        if (colon != std::string::npos && colon != 0)
+        request_parser::field field = parser_.header(i);
+        switch (field.id_)
         {
-            auto name = header.substr(0, colon);
-            auto value = header.substr(colon + 1, header.length() - (colon + 1)); // also exclude '\r'
-            trim_whitespace(name);
-            trim_whitespace(value);
-
-            auto& currentValue = request_.headers()[name];
-            if (currentValue.empty() || boost::iequals(name, header_names::content_length)) // (content-length is already set)
-            {
-                currentValue = value;
-            }
-            else
-            {
-                currentValue += ", " + value;
-            }
+        case header_id::content_length:
+            has_length = parse_content_length(field.value_, read_size_);
+            break;
+        case header_id::connection:
+            // check if the client has requested we close the connection
+            if (boost::iequals(field.value_, "close"))
+                read_closed_ = true;
+            break;
+        case header_id::transfer_encoding:
+            if (boost::ifind_first(field.value_, "chunked"))
+                chunked_ = true;
+            break;
+        default:
+            break;
         }
+
+        if (header_id::content_length == field.id_) // (content-length is already set)
+            headers.set(header_id::content_length, field.value_);
+        else if (field.id_ != header_id::unknown)
+            headers.add(field.id_, field.value_);
         else
-        {
-            request_.reply_if_not_already(status_codes::BadRequest);
-            close_ = true;
-            do_response(true);
-            return;
-        }
+            headers.add(field.name_, field.value_);
     }
 
-    close_ = chunked_ = false;
-    std::string name;
-    // check if the client has requested we close the connection
-    if (request_.headers().match(header_names::connection, name))
-    {
-        close_ = boost::iequals(name, "close");
-    }
+    // the parsed views point into the receive buffer, drop them together with the request line and the headers
+    request_buf_.consume(parser_.consumed());
+    parser_.reset();
 
-    if (request_.headers().match(header_names::transfer_encoding, name))
-    {
-        chunked_ = boost::ifind_first(name, "chunked");
-    }
+    auto buf = snode::streams::producer_consumer_buffer<uint8_t>::create_shared_instance(512);
+    // reading the body stops while the handler has not consumed up to the high watermark
+    buf->get_impl()->set_watermarks(p_service_->body_buffer_high(), p_service_->body_buffer_low());
+    request_.get_impl()->set_instream(buf->create_istream());
+    request_.get_impl()->set_outstream(buf->create_ostream()/*, false*/);
 
-    snode::streams::producer_consumer_buffer<uint8_t> buf(512);
-    request_.get_impl()->set_instream(buf.create_istream());
-    request_.get_impl()->set_outstream(buf.create_ostream()/*, false*/);
+    // the handler gets the request before its body, which is streamed in as it arrives
+    dispatch_request_to_listener();
 
+    read_ = 0;
     if (chunked_)
     {
-        boost::asio::async_read_until(*socket_, request_buf_, CRLF,
-                ALLOC_HANDLER(boost::bind(&http_connection::handle_chunked_header, this, placeholders::error)));
-
-        dispatch_request_to_listener();
+        decoder_.reset();
+        read_chunked_body();
         return;
     }
 
-    if (!request_.headers().match(header_names::content_length, read_size_))
+    if (!has_length)
     {
         read_size_ = 0;
     }
@@ -396,154 +393,175 @@ void http_connection::handle_headers()
     if (read_size_ == 0)
     {
         request_.get_impl()->complete(0);
+        request_read_done();
     }
     else // need to read the sent data
     {
-        read_ = 0;
-        async_read_until_buffersize(std::min(ChunkSize, read_size_),
-                ALLOC_HANDLER(boost::bind(&http_connection::handle_body, this, placeholders::error)));
+        body_left_ = read_size_;
+        read_body_data();
     }
-
-    dispatch_request_to_listener();
 }
 
-void http_connection::handle_chunked_header(const boost::system::error_code& ec)
+void http_connection::read_chunked_body()
 {
-    if (ec)
-    {
-        request_.get_impl()->complete(0 /*,std::make_exception_ptr(http_exception(ec.value()))*/);
-    }
-    else
+    // chunk size lines, the chunk ends and the trailer come through request_buf_, so do small chunks sent with them.
+    // The data of a chunk bigger than what is buffered is read from the socket into the body stream buffer.
+    for (;;)
     {
-        std::istream is(&request_buf_);
-        is.imbue(std::locale::classic());
-        int len;
-        is >> std::hex >> len;
-        request_buf_.consume(CRLF.size());
-        read_ += len;
-        if (len == 0)
+        size_t consumed = 0;
+        chunked_decoder::result result = decoder_.parse(buffer_cast<const char*>(request_buf_.data()), request_buf_.size(), consumed);
+        request_buf_.consume(consumed);
+
+        switch (result)
         {
+        case chunked_decoder::payload:
+            if (request_buf_.size())
+            {
+                size_t count = static_cast<size_t>(std::min<uint64_t>(decoder_.payload_left(), request_buf_.size()));
+                if (!copy_buffered_body(count))
+                    return;
+                read_ += count;
+                decoder_.consume_payload(count);
+                continue;
+            }
+            body_left_ = static_cast<size_t>(std::min<uint64_t>(decoder_.payload_left(), std::numeric_limits<size_t>::max()));
+            read_body_data();
+            return;
+        case chunked_decoder::done:
             request_.get_impl()->complete(read_);
-        }
-        else
-        {
-            async_read_until_buffersize(len + 2,
-                    ALLOC_HANDLER(boost::bind(&http_connection::handle_chunked_body, this, placeholders::error, len)));
+            request_read_done();
+            return;
+        case chunked_decoder::error:
+            request_.get_impl()->complete(0);
+            stop_reading();
+            return;
+        case chunked_decoder::incomplete:
+            if (wait_body_drained())
+                return;
+            boost::asio::async_read(*socket_, request_buf_, transfer_at_least(1),
+                    ALLOC_HANDLER(boost::bind(&http_connection::handle_chunked_data, this, placeholders::error)));
+            return;
         }
     }
 }
 
-void http_connection::handle_chunked_body(const boost::system::error_code& ec, int toWrite)
+void http_connection::handle_chunked_data(const boost::system::error_code& ec)
 {
     if (ec)
     {
         request_.get_impl()->complete(0 /*,std::make_exception_ptr(http_exception(ec.value()))*/);
+        stop_reading();
+        return;
     }
-    else
-    {
-        auto writebuf = request_.get_impl()->outstream().streambuf();
-        /* TODO use putn_nocopy */
-        writebuf.putn(buffer_cast<const uint8_t*>(request_buf_.data()), toWrite,
-                std::bind(&http_connection::handle_chunked_body_buff_write, this, std::placeholders::_1));
-    }
+    read_chunked_body();
 }
 
-void http_connection::handle_chunked_body_buff_write(size_t count)
+bool http_connection::copy_buffered_body(size_t count)
 {
-    if (count)
-    {
-        request_buf_.consume(2 + count); // clear the buffer
-        boost::asio::async_read_until(*socket_, request_buf_, CRLF,
-                ALLOC_HANDLER(boost::bind(&http_connection::handle_chunked_header, this, placeholders::error)));
-    }
-    else
+    auto& writebuf = request_.get_impl()->outstream().streambuf();
+    uint8_t* data = writebuf.alloc(count);
+    if (!data)
     {
-        request_.get_impl()->complete(0 /*,std::current_exception()*/);
-        return;
+        request_.get_impl()->complete(0);
+        stop_reading();
+        return false;
     }
+    memcpy(data, buffer_cast<const uint8_t*>(request_buf_.data()), count);
+    writebuf.commit(count);
+    request_buf_.consume(count);
+    return true;
 }
 
-void http_connection::handle_body(const boost::system::error_code& ec)
+void http_connection::read_body_data()
 {
-    // read body
-    if (ec)
+    if (!body_left_)
     {
-        request_.get_impl()->complete(0 /* , std::make_exception_ptr(http_exception(ec.value())) */);
+        if (chunked_)
+        {
+            read_chunked_body();
+        }
+        else
+        {
+            request_.get_impl()->complete(read_);
+            request_read_done();
+        }
+        return;
     }
-    else if (read_ < read_size_)  // there is more to read
+
+    if (request_buf_.size())
     {
-        auto writebuf = request_.get_impl()->outstream().streambuf();
-        /* TODO use putn_nocopy */
-        writebuf.putn(buffer_cast<const uint8_t*>(request_buf_.data()),
-                std::min(request_buf_.size(), read_size_ - read_),
-                    std::bind(&http_connection::handle_body_buff_write, this, std::placeholders::_1));
+        // body bytes received together with the headers
+        size_t count = std::min(request_buf_.size(), body_left_);
+        if (copy_buffered_body(count))
+            body_data_read(count);
+        return;
     }
-    else  // have read request body
+
+    // the rest is read from the socket straight into the body stream buffer
+    auto& writebuf = request_.get_impl()->outstream().streambuf();
+    size_t count = std::min(read_chunk_.size(), body_left_);
+    uint8_t* data = writebuf.alloc(count);
+    if (!data)
     {
-        request_.get_impl()->complete(read_);
+        request_.get_impl()->complete(0);
+        stop_reading();
+        return;
     }
+    socket_->async_read_some(buffer(data, count),
+            ALLOC_HANDLER(boost::bind(&http_connection::handle_body_data, this, placeholders::error,
+                                      placeholders::bytes_transferred, count)));
 }
 
-void http_connection::handle_body_buff_write(size_t count)
+void http_connection::handle_body_data(const boost::system::error_code& ec, size_t count, size_t requested)
 {
-    if (count)
-    {
-        read_ += count;
-        request_buf_.consume(count);
-        async_read_until_buffersize(std::min(ChunkSize, read_size_ - read_),
-                ALLOC_HANDLER(boost::bind(&http_connection::handle_body, this, placeholders::error)));
-    }
-    else
+    auto& writebuf = request_.get_impl()->outstream().streambuf();
+    writebuf.commit(ec ? 0 : count);
+    if (ec)
     {
-        request_.get_impl()->complete(0 /*,std::current_exception()*/);
+        request_.get_impl()->complete(0 /* , std::make_exception_ptr(http_exception(ec.value())) */);
+        stop_reading();
         return;
     }
+
+    read_chunk_.update(requested, count);
+    body_data_read(count);
 }
 
-template <typename ReadHandler>
-void http_connection::async_read_until_buffersize(size_t size, const ReadHandler &handler)
+void http_connection::body_data_read(size_t count)
 {
-    auto bufsize = request_buf_.size();
-    if (bufsize >= size)
-    {
-        boost::asio::async_read(*socket_, request_buf_, transfer_at_least(0), handler);
-    }
-    else
-    {
-        boost::asio::async_read(*socket_, request_buf_, transfer_at_least(size - bufsize), handler);
-    }
+    body_left_ -= count;
+    read_ += count;
+    if (chunked_)
+        decoder_.consume_payload(count);
+    if (!wait_body_drained())
+        read_body_data();
 }
 
-void http_connection::dispatch_request_to_listener()
+bool http_connection::wait_body_drained()
 {
-    // locate the listener:
-    //http_listener_impl* pListener = nullptr;
-    http_req_handler* p_handler = nullptr;
-    {
-        auto path_segments = uri::split_path(request_.request_url());
-        for (auto i = static_cast<long>(path_segments.size()); i >= 0; --i)
-        {
-            std::string path = "";
-            for (size_t j = 0; j < static_cast<size_t>(i); ++j)
-            {
-                path += "/" + path_segments[j];
-            }
-            path += "/";
+    // resume once the handler drains the body buffer below the low watermark
+    auto writebuf = request_.get_impl()->outstream().streambuf().get_impl();
+    if (!writebuf->is_full())
+        return false;
 
-            // locate handler
-            p_handler = p_service_->get_req_handler(path);
-        }
-    }
+    writebuf->wait_for_space(boost::bind(&http_connection::read_body_data, this));
+    return true;
+}
+
+void http_connection::dispatch_request_to_listener()
+{
+    // locate the handler registered for the longest prefix of the URL path
+    http_req_handler* p_handler = p_service_->get_req_handler(request_.request_url());
 
     if (nullptr == p_handler)
     {
         request_.reply_if_not_already(status_codes::NotFound);
-        do_response(false);
+        queue_request(false);
     }
     else
     {
-        // wait for the response to become ready
-        do_response(false);
+        // the response is written once it is ready and all the responses to the earlier requests are written
+        queue_request(false);
         try
         {
             p_handler->handle_request(request_);
@@ -555,13 +573,16 @@ void http_connection::dispatch_request_to_listener()
     }
 }
 
-void http_connection::do_response(bool bad_request)
-{
-    request_.get_response(std::bind(&http_connection::handle_response, this, std::placeholders::_1, bad_request));
-}
-
 void http_connection::handle_response(http_response& response, bool bad_request)
 {
+    if (closing_)
+    {
+        writing_ = false;
+        finish_request_response();
+        return;
+    }
+
+    http_request& request = pipeline_.front().request_;
     // before sending response, the full incoming message need to be processed.
     if (bad_request)
     {
@@ -569,157 +590,241 @@ void http_connection::handle_response(http_response& response, bool bad_request)
     }
     else
     {
-        if (request_.get_impl()->get_data_available())
+        if (request.get_impl()->get_data_available())
             async_process_response(response);
         else
-            request_.content_ready(std::bind(&http_connection::handle_request_data_ready, this, std::placeholders::_1, response));
+            request.content_ready(std::bind(&http_connection::handle_request_data_ready, this, std::placeholders::_1, response));
     }
 }
 
 void http_connection::async_process_response(http_response& response)
 {
-    response_buf_.consume(response_buf_.size()); // clear the buffer
-    std::ostream os(&response_buf_);
-    os.imbue(std::locale::classic());
-
-    os << "HTTP/1.1 " << response.status_code() << " "
-        << response.reason_phrase()
-        << CRLF;
+    // a producer writing faster than the client reads is held back by the body buffer watermarks
+    if (response.body())
+    {
+        auto& readbuf = response.get_impl()->instream().streambuf();
+        if (!readbuf.get_impl()->has_watermarks())
+            readbuf.get_impl()->set_watermarks(p_service_->body_buffer_high(), p_service_->body_buffer_low());
+    }
 
-    chunked_ = false;
+    write_chunked_ = false;
     write_ = write_size_ = 0;
 
-    std::string transferencoding;
-    if (response.headers().match(header_names::transfer_encoding, transferencoding) && transferencoding == "chunked")
+    http_headers& headers = response.headers();
+    const auto& file = response.get_impl()->get_file_body();
+    if (file)
     {
-        chunked_  = true;
+        // set_file_body() has set the Content-Length
+        write_size_ = file->length();
     }
-
-    if (!response.headers().match(header_names::content_length, write_size_) && response.body())
+    else
     {
-        chunked_ = true;
-        response.headers()[header_names::transfer_encoding] = "chunked";
-    }
+        if (headers.value(header_id::transfer_encoding) == "chunked")
+        {
+            write_chunked_  = true;
+        }
 
-    if (!response.body())
-    {
-        response.headers().add(header_names::content_length,0);
-    }
+        if (!headers.match(header_id::content_length, write_size_) && response.body())
+        {
+            write_chunked_ = true;
+            headers.set(header_id::transfer_encoding, "chunked");
+        }
 
-    for(const auto & header : response.headers())
-    {
-        // check if the responder has requested we close the connection
-        if (boost::iequals(header.first, "connection"))
+        if (!response.body())
         {
-            if (boost::iequals(header.second, "close"))
-                close_ = true;
+            headers.add(header_id::content_length, "0");
         }
-        os << header.first << ": " << header.second << CRLF;
     }
-    os << CRLF;
-    boost::asio::async_write(*socket_, response_buf_,
-            ALLOC_HANDLER(boost::bind(&http_connection::handle_headers_written, this, response, placeholders::error)));
-}
 
-void http_connection::cancel_sending_response_with_error(const http_response& response, http::error_code& ec)
-{
-    request_.get_impl()->response_send_complete(ec);
-    // always terminate the connection since error happens
-    finish_request_response();
-}
+    // check if the responder has requested we close the connection
+    if (boost::iequals(headers.value(header_id::connection), "close"))
+        close_ = true;
 
-void http_connection::handle_write_chunked_response(const http_response& response, const boost::system::error_code& ec)
-{
-    if (ec)
-    {
-        return handle_response_written(response, ec);
-    }
+    serialize_response_head(response);
 
-    auto readbuf = response.get_impl()->instream().streambuf();
-    if (readbuf.is_eof())
+    if (file && write_size_)
     {
-        boost::system::error_code ec(boost::system::errc::make_error_code(boost::system::errc::io_error));
-        http::error_code err(ec);
-        return cancel_sending_response_with_error(response, err);
+        boost::asio::async_write(*socket_, response_buf_,
+                ALLOC_HANDLER(boost::bind(&http_connection::send_file_body, this, response, placeholders::error)));
     }
-    auto membuf = response_buf_.prepare(ChunkSize + snode::http::chunked_encoding::additional_encoding_space);
-
-    readbuf.getn(buffer_cast<uint8_t *>(membuf) + snode::http::chunked_encoding::additional_encoding_space, ChunkSize,
-            std::bind(&http_connection::handle_chunked_response_buff_read, this, std::placeholders::_1, buffer_cast<uint8_t*>(membuf), response));
-}
-
-void http_connection::handle_chunked_response_buff_read(size_t count, uint8_t* membuf, http_response& response)
-{
-    if (!count || !membuf)
+    // the head goes out together with the first piece of the body
+    else if (file || !response.body() || (!write_chunked_ && !write_size_))
     {
-        boost::system::error_code ec(boost::system::errc::make_error_code(boost::system::errc::io_error));
-        http::error_code err(ec);
-        return cancel_sending_response_with_error(response, err);
+        boost::asio::async_write(*socket_, response_buf_,
+                ALLOC_HANDLER(boost::bind(&http_connection::handle_response_written, this, response, placeholders::error)));
     }
     else
     {
-        size_t offset = http::chunked_encoding::add_chunked_delimiters(membuf, ChunkSize + snode::http::chunked_encoding::additional_encoding_space, count);
-        response_buf_.commit(count + snode::http::chunked_encoding::additional_encoding_space);
-        response_buf_.consume(offset);
-        boost::asio::async_write(*socket_, response_buf_,
-                ALLOC_HANDLER(boost::bind(count == 0 ? &http_connection::handle_response_written : &http_connection::handle_write_chunked_response,
-                                          this, response, placeholders::error)));
+        read_response_body(response);
     }
 }
 
-void http_connection::handle_write_large_response(const http_response &response, const boost::system::error_code& ec)
+void http_connection::serialize_response_head(const http_response& response)
 {
-    if (ec || (write_ == write_size_))
-        return handle_response_written(response, ec);
+    response_buf_.consume(response_buf_.size()); // clear the buffer
 
-    auto readbuf = response.get_impl()->instream().streambuf();
-    if (readbuf.is_eof())
+    char status[16] = "HTTP/1.1 000 ";
+    unsigned code = response.status_code();
+    status[9] = static_cast<char>('0' + code / 100 % 10);
+    status[10] = static_cast<char>('0' + code / 10 % 10);
+    status[11] = static_cast<char>('0' + code % 10);
+    response_buf_.sputn(status, 13);
+    response_buf_.sputn(response.reason_phrase().data(), static_cast<std::streamsize>(response.reason_phrase().size()));
+    response_buf_.sputn("\r\n", 2);
+
+    for (const auto& header : response.headers())
     {
-        http::error_code err(boost::system::errc::make_error_code(boost::system::errc::io_error));
-        cancel_sending_response_with_error(response, err);
-        return;
+        response_buf_.sputn(header.first.data(), static_cast<std::streamsize>(header.first.size()));
+        response_buf_.sputn(": ", 2);
+        response_buf_.sputn(header.second.data(), static_cast<std::streamsize>(header.second.size()));
+        response_buf_.sputn("\r\n", 2);
     }
-    size_t readBytes = std::min(ChunkSize, write_size_ - write_);
+    response_buf_.sputn("\r\n", 2);
+}
 
-    auto membuf = response_buf_.prepare(readBytes);
-    readbuf.getn(buffer_cast<uint8_t *>(membuf), readBytes,
-            std::bind(&http_connection::handle_large_response_buff_read, this, std::placeholders::_1, response));
+void http_connection::read_response_body(const http_response& response)
+{
+    // wait for a chunk worth of data
+    size_t wanted = write_chunked_ ? write_chunk_.size() : std::min(write_chunk_.size(), write_size_ - write_);
+    auto& readbuf = response.get_impl()->instream().streambuf();
+    readbuf.get_impl()->wait_available(wanted,
+            std::bind(&http_connection::handle_response_body_ready, this, std::placeholders::_1, response));
 }
 
-void http_connection::handle_large_response_buff_read(size_t count, http_response& response)
+void http_connection::handle_response_body_ready(size_t available, const http_response& response)
 {
+    // one gathered write: the response head if not sent yet, the chunk size line, the data blocks and the chunk end
+    std::array<const_buffer, s_max_write_blocks + 3> buffers;
+    buffers[0] = const_buffer(buffer_cast<const void*>(response_buf_.data()), response_buf_.size());
+
+    size_t count = 0;
+    if (available)
+    {
+        size_t window = write_chunked_ ? write_chunk_.size() : std::min(write_chunk_.size(), write_size_ - write_);
+        body_buffer::block_span blocks[s_max_write_blocks];
+        auto& readbuf = response.get_impl()->instream().streambuf();
+        size_t block_count = readbuf.get_impl()->acquire_blocks(blocks, s_max_write_blocks, window);
+        for (size_t i = 0; i < block_count; i++)
+        {
+            buffers[2 + i] = buffer(blocks[i].ptr_, blocks[i].count_);
+            count += blocks[i].count_;
+        }
+        // a write limited by the number of blocks says nothing about the socket
+        write_chunk_.update(block_count < s_max_write_blocks ? window : count, count);
+        if (write_chunked_ && count)
+        {
+            buffers[1] = buffer(chunk_prefix_, chunked_encoding::format_chunk_prefix(chunk_prefix_, count));
+            buffers[2 + block_count] = buffer(chunked_encoding::chunk_suffix, sizeof(chunked_encoding::chunk_suffix) - 1);
+        }
+    }
+
     if (!count)
     {
-        boost::system::error_code ec(boost::system::errc::make_error_code(boost::system::errc::io_error));
-        http::error_code err(ec);
-        return cancel_sending_response_with_error(response, err);
+        if (!write_chunked_)
+        {
+            http::error_code err(boost::system::errc::make_error_code(boost::system::errc::io_error));
+            return cancel_sending_response_with_error(response, err);
+        }
+
+        // end of the body, the last chunk
+        buffers[1] = buffer(chunked_encoding::last_chunk, sizeof(chunked_encoding::last_chunk) - 1);
+        boost::asio::async_write(*socket_, buffers,
+                ALLOC_HANDLER(boost::bind(&http_connection::handle_response_written, this, response, placeholders::error)));
+        return;
     }
 
-    write_ += count;
-    response_buf_.commit(count);
-    boost::asio::async_write(*socket_, response_buf_,
-            ALLOC_HANDLER(boost::bind(&http_connection::handle_write_large_response, this, response, placeholders::error)));
+    write_acquired_ = count;
+    boost::asio::async_write(*socket_, buffers,
+            ALLOC_HANDLER(boost::bind(&http_connection::handle_response_body_written, this, response, placeholders::error)));
 }
 
-void http_connection::handle_headers_written(const http_response& response, const boost::system::error_code& ec)
+void http_connection::handle_response_body_written(const http_response& response, const boost::system::error_code& ec)
+{
+    auto& readbuf = response.get_impl()->instream().streambuf();
+    readbuf.get_impl()->release_blocks(write_acquired_);
+    write_ += write_acquired_;
+    write_acquired_ = 0;
+
+    response_buf_.consume(response_buf_.size());
+    if (ec || (!write_chunked_ && write_ == write_size_))
+        return handle_response_written(response, ec);
+
+    read_response_body(response);
+}
+
+void http_connection::send_file_body(const http_response& response, const boost::system::error_code& ec)
 {
     if (ec)
     {
-        boost::system::error_code ec(boost::system::errc::make_error_code(boost::system::errc::io_error));
-        http::error_code err(ec);
-        return cancel_sending_response_with_error(response, err);
+        source_wait_.reset();
+        return handle_response_written(response, ec);
     }
-    else
+
+    // the kernel moves the data from the file to the socket until the socket buffer is full,
+    // then wait for the socket to become writable again
+    auto& file = *response.get_impl()->get_file_body();
+    socket_->native_non_blocking(true);
+    for (size_t turn = 0; write_ < write_size_ && turn < s_sendfile_turn; )
     {
-        if (chunked_)
+        ssize_t sent = file.transfer_to(socket_->native_handle(), std::min(s_sendfile_turn - turn, write_size_ - write_));
+        if (sent > 0)
         {
-            handle_write_chunked_response(response, ec);
+            write_ += static_cast<size_t>(sent);
+            turn += static_cast<size_t>(sent);
+        }
+        else if (sent < 0 && EINTR == errno)
+        {
+            continue;
+        }
+        else if (sent < 0 && (EAGAIN == errno || EWOULDBLOCK == errno))
+        {
+            break;
         }
         else
         {
-            handle_write_large_response(response, ec);
+            // end of the file before Content-Length bytes or a failure
+            source_wait_.reset();
+            http::error_code err(boost::system::errc::make_error_code(boost::system::errc::io_error));
+            return cancel_sending_response_with_error(response, err);
         }
     }
+
+    if (write_ == write_size_)
+    {
+        source_wait_.reset();
+        return handle_response_written(response, ec);
+    }
+
+    if (write_ < write_size_ && file.source_empty())
+    {
+        // the pipe producer is behind, wait for it and not for the writable socket which would spin;
+        // the reactor gets a duplicate of the descriptor, the file body keeps closing its own
+        if (!source_wait_)
+        {
+            int fd = dup(file.fd());
+            if (fd < 0)
+            {
+                http::error_code err(boost::system::errc::make_error_code(boost::system::errc::io_error));
+                return cancel_sending_response_with_error(response, err);
+            }
+            source_wait_.reset(new boost::asio::posix::stream_descriptor(socket_->get_io_service(), fd));
+        }
+        source_wait_->async_read_some(boost::asio::null_buffers(),
+                ALLOC_HANDLER(boost::bind(&http_connection::send_file_body, this, response, placeholders::error)));
+        return;
+    }
+
+    socket_->async_write_some(boost::asio::null_buffers(),
+            ALLOC_HANDLER(boost::bind(&http_connection::send_file_body, this, response, placeholders::error)));
+}
+
+void http_connection::cancel_sending_response_with_error(const http_response& response, http::error_code& ec)
+{
+    pipeline_.front().request_.get_impl()->response_send_complete(ec);
+    pipeline_.pop_front();
+    writing_ = false;
+    // always terminate the connection since error happens
+    finish_request_response();
 }
 
 void http_connection::handle_response_written(const http_response& response, const boost::system::error_code& ec)
@@ -733,21 +838,33 @@ void http_connection::handle_response_written(const http_response& response, con
     else
     {
         http::error_code err(ec);
-        request_.get_impl()->response_send_complete(err);
-        if (!close_)
-        {
-            start_request_response();
-        }
-        else
+        pipeline_.front().request_.get_impl()->response_send_complete(err);
+        pipeline_.pop_front();
+        writing_ = false;
+
+        if (close_ || closing_ || (read_closed_ && pipeline_.empty() && !reading_))
         {
             finish_request_response();
+            return;
         }
+
+        if (!pipeline_.empty())
+            respond_to_next();
+
+        // resume reading if the pipeline was full
+        if (!reading_ && !read_closed_ && pipeline_.size() < s_max_pipeline_depth)
+            read_next_request();
     }
 }
 
 void http_connection::finish_request_response()
 {
+    closing_ = true;
     close();
+    // an outstanding operation completes with an error and finishes the connection
+    if (reading_ || writing_)
+        return;
+
     p_listener_->drop_connection(shared_from_this());
 }
 
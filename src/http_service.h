@@ -7,14 +7,22 @@
 
 #include <set>
 #include <map>
+#include <deque>
+#include <vector>
 #include <string>
 #include <boost/asio.hpp>
 
 #include "http_msg.h"
+#include "http_helpers.h"
+#include "http_parser.h"
+#include "chunked_decoder.h"
+#include "path_router.h"
+#include "chunk_sizer.h"
 #include "net_service.h"
 #include "net_service_helpers.h"
 #include "snode_types.h"
 #include "handler_allocator.h"
+#include "slab_allocator.h"
 
 namespace snode
 {
@@ -25,27 +33,66 @@ class http_service;
 class http_listener;
 
 /// HTTP server session.
+/// Requests are read ahead while earlier ones are still being handled (HTTP/1.1 pipelining), every request is
+/// dispatched to its handler as soon as its headers are parsed and the responses are written in request order.
 class http_connection :  public boost::enable_shared_from_this<http_connection>
 {
 private:
+    /// Request waiting for its response to be written.
+    struct pending_request
+    {
+        pending_request(const http_request& request, bool bad_request) : request_(request), bad_request_(bad_request)
+        {}
+
+        http_request request_;
+        bool bad_request_;
+    };
+
+    /// Maximum number of requests read ahead of the response being written.
+    static const size_t s_max_pipeline_depth = 16;
+
+    /// Most body buffer blocks in one response body write.
+    static const size_t s_max_write_blocks = 32;
+
+    /// File response body bytes sent before the other connections of the worker get a turn.
+    static const size_t s_sendfile_turn = 1024 * 1024;
+
+    typedef streams::producer_consumer_buffer<uint8_t> body_buffer;
+
     snode::handler_allocator allocator_; // using the default allocator
     tcp_socket_ptr socket_;
+    std::unique_ptr<boost::asio::posix::stream_descriptor> source_wait_; // pipe response body waited for
     boost::asio::streambuf request_buf_;
     boost::asio::streambuf response_buf_;
     http_service* p_service_;
     http_listener* p_listener_;
-    http_request request_;
+    http_request request_;      // request being read
+    request_parser parser_;
+    chunked_decoder decoder_;   // request body framing when chunked_
+    std::deque<pending_request, pool_allocator<pending_request> > pipeline_; // in request order, the front one is answered
+    char chunk_prefix_[chunked_encoding::max_chunk_prefix];
     size_t read_, write_;
     size_t read_size_, write_size_;
-    bool close_;
-    bool chunked_;
+    size_t body_left_;          // request body bytes left, of the body or of the current chunk
+    size_t write_acquired_;     // response body bytes in the write being sent, released when it completes
+    chunk_sizer read_chunk_;    // request body read granularity
+    chunk_sizer write_chunk_;   // response body write granularity
+    bool close_;                // close the connection after the response being written
+    bool read_closed_;          // no more requests will be read
+    bool closing_;              // connection is shut down, waiting for the outstanding operations to complete
+    bool reading_;              // a request is being read
+    bool writing_;              // the front request is being answered
+    bool chunked_;              // request body is chunked
+    bool write_chunked_;        // response body is chunked
     thread_id_t worker_id_;
     
 public:
     http_connection(tcp_socket_ptr socket, http_service* service, http_listener* listener, thread_id_t id) : socket_(socket), request_buf_()
-    , response_buf_(), p_service_(service), p_listener_(listener), worker_id_(id)
+    , response_buf_(), p_service_(service), p_listener_(listener), read_(0), write_(0), read_size_(0), write_size_(0), body_left_(0), write_acquired_(0)
+    , close_(false), read_closed_(false), closing_(false), reading_(false), writing_(false), chunked_(false), write_chunked_(false)
+    , worker_id_(id)
     {
-        start_request_response();
+        read_next_request();
     }
 
     http_connection(const http_connection&) = delete;
@@ -53,22 +100,36 @@ public:
 
     void close();
 
+    /// Request body read statistics.
+    const transfer_stats& read_stats() const { return read_chunk_.stats(); }
+
+    /// Response body write statistics.
+    const transfer_stats& write_stats() const { return write_chunk_.stats(); }
+
 private:
-    void start_request_response();
+    void read_next_request();
+    void request_read_done();
+    void stop_reading();
+    void reject_request();
+    void queue_request(bool bad_request);
+    void respond_to_next();
     void handle_http_line(const boost::system::error_code& ec);
     void handle_headers();
-    void handle_body(const boost::system::error_code& ec);
-    void handle_chunked_header(const boost::system::error_code& ec);
-    void handle_chunked_body(const boost::system::error_code& ec, int toWrite);
+    void read_chunked_body();
+    void handle_chunked_data(const boost::system::error_code& ec);
+    bool copy_buffered_body(size_t count);
+    void read_body_data();
+    void handle_body_data(const boost::system::error_code& ec, size_t count, size_t requested);
+    void body_data_read(size_t count);
+    bool wait_body_drained();
     void dispatch_request_to_listener();
-    void do_response(bool bad_request);
-    template <typename ReadHandler>
-    void async_read_until_buffersize(size_t size, const ReadHandler &handler);
     void async_process_response(http_response& response);
+    void serialize_response_head(const http_response& response);
+    void read_response_body(const http_response& response);
+    void handle_response_body_ready(size_t available, const http_response& response);
+    void handle_response_body_written(const http_response& response, const boost::system::error_code& ec);
+    void send_file_body(const http_response& response, const boost::system::error_code& ec);
     void cancel_sending_response_with_error(const http_response& response, http::error_code& ec);
-    void handle_headers_written(const http_response& response, const boost::system::error_code& ec);
-    void handle_write_large_response(const http_response& response, const boost::system::error_code& ec);
-    void handle_write_chunked_response(const http_response& response, const boost::system::error_code& ec);
     void handle_response_written(const http_response& response, const boost::system::error_code& ec);
     void finish_request_response();
 
@@ -79,10 +140,6 @@ private:
     }
 
     void handle_response(http_response& response, bool bad_request);
-    void handle_body_buff_write(size_t count);
-    void handle_chunked_body_buff_write(size_t count);
-    void handle_chunked_response_buff_read(size_t count, uint8_t* membuf, http_response& response);
-    void handle_large_response_buff_read(size_t count, http_response& response);
 };
 
 /// Custom HTTP request handler.
@@ -156,7 +213,10 @@ public:
 
     void drop_connection(http_conn_ptr conn);
 
-    std::set<http_conn_ptr> connections_;
+    /// Close all connections of the listener, before its worker io_service is destroyed.
+    void do_stop();
+
+    std::set<http_conn_ptr, std::less<http_conn_ptr>, pool_allocator<http_conn_ptr> > connections_;
 };
 
 /// HTTP service class.
@@ -172,9 +232,29 @@ public:
     /// Entry point for every network service where a new connection is accepted and handled.
     void accept(tcp_socket_ptr sock);
 
-    /// Get HTTP request handler object for registered to handle the given (url_path)
-    /// If there are no handlers registered to handle this URL a NULL is returned.
-    http_req_handler* get_req_handler(const std::string& url_path);
+    /// Close the connections of all listeners, called before the worker threads are stopped.
+    void stop();
+
+    /// Get HTTP request handler object registered for the longest path prefix of the given (url)
+    /// from the calling worker's router. If there are no handlers registered to handle this URL a NULL is returned.
+    http_req_handler* get_req_handler(boost::string_ref url);
+
+    /// Option setting the largest request and response body chunk size of a connection.
+    static const char* s_max_chunk_option;
+
+    /// Option setting the memory budget for the body chunks of all connections.
+    static const char* s_chunk_memory_option;
+
+    /// Options setting the watermarks of the request and response body buffers of a connection, see
+    /// producer_consumer_buffer::set_watermarks(). Response buffers with watermarks of their own keep them.
+    static const char* s_body_buffer_high_option;
+    static const char* s_body_buffer_low_option;
+
+    static const size_t s_default_body_buffer_high = 1024 * 1024;
+    static const size_t s_default_body_buffer_low = 256 * 1024;
+
+    size_t body_buffer_high() const { return body_buffer_high_; }
+    size_t body_buffer_low() const { return body_buffer_low_; }
 
     static http_service* instance()
     {
@@ -185,10 +265,12 @@ public:
 private:
     typedef boost::shared_ptr<http_req_handler> req_handler_ptr;
 
-    // HTTP request handlers for every thread. ( thread id => ( URL path => handler ) )
-    std::map<thread_id_t, std::map<std::string, req_handler_ptr>> handlers_;
+    // HTTP request handlers for every thread. ( worker index => ( URL path prefix => handler ) )
+    std::vector<path_router<req_handler_ptr>> handlers_;
 
     net_service_listener_factory<http_listener> listeners_factory_;
+    size_t body_buffer_high_;
+    size_t body_buffer_low_;
 };
 
 /// Wrapper class to register with the service factory
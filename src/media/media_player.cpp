@@ -3,6 +3,7 @@
 // Copyright (C) 2015  Emil Penchev, Bulgaria
 
 #include "media_player.h"
+#include <cstdlib>
 #include <functional>
 
 namespace snode
@@ -10,8 +11,16 @@ namespace snode
 namespace media
 {
 
+const char* media_player::s_buffer_high_option = "bufferHigh";
+const char* media_player::s_buffer_low_option = "bufferLow";
+
+// stream options set by snode_config::read_streams()
+static const char* s_source_option = "source";
+static const char* s_filter_option = "filter";
+
 media_player::media_player(const std::string& name, source_ptr source, filter_ptr filter = nullptr)
-     : streambuf_(media_player::buf_size), source_(source), filter_(filter)
+     : streambuf_(streams::concurrent_buffer<char_type>::create_shared_instance(media_player::buf_size)),
+       source_(source), filter_(filter)
 {
     stream_ = source_->stream();
     streamlive_ = source_->live_stream();
@@ -20,9 +29,26 @@ media_player::media_player(const std::string& name, source_ptr source, filter_pt
 void media_player::play()
 {
     if (stream_.is_open())
-        stream_.read(streambuf_, media_player::buf_size, std::bind(&media_player::read_handler, this, std::placeholders::_1));
+        read_next(0);
     else if (streamlive_.is_open())
-        streamlive_.read(streambuf_, media_player::buf_size, std::bind(&media_player::read_handler_live, this, std::placeholders::_1));
+        read_next_live(0);
+}
+
+void media_player::set_buffer_limits(size_t high, size_t low)
+{
+    streambuf_->get_impl()->set_watermarks(high, low);
+}
+
+void media_player::configure(const options_map_t& options)
+{
+    auto high = options.find(s_buffer_high_option);
+    if (high == options.end())
+        return;
+
+    size_t high_size = std::strtoul(high->second.c_str(), nullptr, 10);
+    auto low = options.find(s_buffer_low_option);
+    size_t low_size = low != options.end() ? std::strtoul(low->second.c_str(), nullptr, 10) : high_size / 4;
+    set_buffer_limits(high_size, low_size);
 }
 
 void media_player::pause()
@@ -76,21 +102,34 @@ const std::string& media_player::name() const
 
 media_player::stream_type media_player::stream()
 {
-    return streambuf_.create_istream();
+    return streambuf_->create_istream();
 }
 
+// The source fills the buffer with alloc()/commit(), the next read waits until the clients
+// have drained it below the buffer limits.
 void media_player::read_handler(size_t count)
 {
-    stream_.read(streambuf_, media_player::buf_size, std::bind(&media_player::read_handler, this, std::placeholders::_1));
+    streambuf_->get_impl()->wait_for_space(std::bind(&media_player::read_next, this, std::placeholders::_1));
 }
 
 void media_player::read_handler_live(size_t count)
 {
-    streamlive_.read(streambuf_, media_player::buf_size, std::bind(&media_player::read_handler_live, this, std::placeholders::_1));
+    streambuf_->get_impl()->wait_for_space(std::bind(&media_player::read_next_live, this, std::placeholders::_1));
+}
+
+void media_player::read_next(size_t count)
+{
+    stream_.read(*streambuf_, media_player::buf_size, std::bind(&media_player::read_handler, this, std::placeholders::_1));
+}
+
+void media_player::read_next_live(size_t count)
+{
+    streamlive_.read(*streambuf_, media_player::buf_size, std::bind(&media_player::read_handler_live, this, std::placeholders::_1));
 }
 
 player_factory::player_ptr player_factory::create(const std::string& name, const std::string& source_type,
-                                                  const std::string& filter_type = "", const std::string& filter_opt = "")
+                                                  const std::string& filter_type, const std::string& filter_opt,
+                                                  const options_map_t& options)
 {
     // check if we have a player with that name
     auto search = players_.find(name);
@@ -105,24 +144,36 @@ player_factory::player_ptr player_factory::create(const std::string& name, const
     if (!source)
         return player_ptr(nullptr);
 
-    if (!filter_type.empty() && !filter_opt.empty())
+    if (!filter_type.empty())
     {
         media_player::filter_ptr filter(filter_factory::create_instance(filter_type));
-        if (filter)
+        if (filter && !filter_opt.empty())
             filter->set_option(filter_opt);
 
         auto player = std::make_shared<media_player>(name, source, filter);
+        player->configure(options);
         players_[name] = player;
         return player;
     }
     else
     {
         auto player = std::make_shared<media_player>(name, source);
+        player->configure(options);
         players_[name] = player;
         return player;
     }
 }
 
+player_factory::player_ptr player_factory::create(const media_config& stream)
+{
+    auto source = stream.options.find(s_source_option);
+    if (stream.options.end() == source)
+        return player_ptr(nullptr);
+
+    auto filter = stream.options.find(s_filter_option);
+    return create(stream.name, source->second, stream.options.end() != filter ? filter->second : "", "", stream.options);
+}
+
 } // end namespace media
 } // end namespace snode
 
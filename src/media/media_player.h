@@ -13,6 +13,7 @@
 #include "media_filter.h"
 #include "reg_factory.h"
 #include "sourcebuf.h"
+#include "config_reader.h"
 
 namespace snode
 {
@@ -27,7 +28,7 @@ public:
     typedef std::shared_ptr<media_filter> filter_ptr;
     typedef media_source::off_type off_type;
     typedef media_source::char_type char_type;
-    typedef streams::async_streambuf<char_type, streams::producer_consumer_buffer<char_type> > streambuf_type;
+    typedef streams::async_streambuf<char_type, streams::concurrent_buffer<char_type> > streambuf_type;
     typedef streambuf_type::istream_type stream_type;
     static const size_t buf_size = 16*1024;
 
@@ -64,10 +65,20 @@ public:
     /// Get player's stream
     stream_type stream();
 
+    /// Limit the data buffered ahead of the stream readers, reading from the source pauses at (high) bytes
+    /// and resumes once the readers drain it down to (low) bytes.
+    void set_buffer_limits(size_t high, size_t low);
+
+    /// Apply the stream options, s_buffer_high_option and s_buffer_low_option set the buffer limits.
+    void configure(const options_map_t& options);
+
+    static const char* s_buffer_high_option;
+    static const char* s_buffer_low_option;
+
 private:
     template<typename media_player> friend class streams::sourcebuf;
     typedef media_source::char_type char_type;
-    typedef streams::async_streambuf<char_type, streams::producer_consumer_buffer<char_type> > streambuf_type;
+    typedef streams::async_streambuf<char_type, streams::concurrent_buffer<char_type> > streambuf_type;
 
     /// Internal program interface to be used only from sourcebuf
     /// media_player is complying with SourceImpl interface
@@ -77,8 +88,10 @@ private:
 
     void read_handler(size_t count);
     void read_handler_live(size_t count);
+    void read_next(size_t count);
+    void read_next_live(size_t count);
 
-    streambuf_type streambuf_;                   // player's internal stream buffer
+    std::shared_ptr<streambuf_type> streambuf_;  // player's internal stream buffer, clients read it from any worker
     source_ptr source_;                          // Source object.
     filter_ptr filter_;                          // Filter object to process source data if specified.
     std::string name_;                           // Name of the stream we are playing.
@@ -100,8 +113,14 @@ public:
 
     /// Factory method, create a new player for a given stream.
     /// If player can't be created NULL is returned instead.
+    /// (options) are the stream options from the configuration, see media_player::configure().
     player_ptr create(const std::string& name, const std::string& sourcetype,
-                      const std::string& filtertype = "", const std::string& filter_opt = "");
+                      const std::string& filtertype = "", const std::string& filter_opt = "",
+                      const options_map_t& options = options_map_t());
+
+    /// Create a player for a configured (stream), the source, filter and buffer limits come from its options.
+    /// If player can't be created NULL is returned instead.
+    player_ptr create(const media_config& stream);
 
 private:
     /// stores the stream name -> player relationship
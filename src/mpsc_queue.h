@@ -0,0 +1,213 @@
+//
+// mpsc_queue.h
+// Copyright (C) 2015  Emil Penchev, Bulgaria
+//
+
+#ifndef MPSC_QUEUE_H_
+#define MPSC_QUEUE_H_
+
+#include <atomic>
+
+#if defined(__linux__)
+#include <unistd.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
+#else
+#include <boost/thread/locks.hpp>
+#include <boost/thread/mutex.hpp>
+#include <boost/thread/condition_variable.hpp>
+#endif
+
+namespace snode
+{
+
+/// Intrusive link for elements of mpsc_queue, elements must derive from it.
+struct mpsc_node
+{
+    mpsc_node() : next_(nullptr)
+    {}
+
+    std::atomic<mpsc_node*> next_;
+};
+
+/// Lock free multi producer / single consumer intrusive queue (unbounded, Vyukov's algorithm).
+/// enqueue() is wait free and never allocates, the consumer is parked (futex on Linux) only when the queue is idle,
+/// so producers issue a wakeup only when the consumer is actually sleeping.
+/// T must derive from mpsc_node, the queue does not own its elements.
+template<typename T>
+class mpsc_queue
+{
+public:
+    mpsc_queue() : head_(&stub_), tail_(&stub_), sleeping_(0)
+    {}
+
+    /// Insert element, can be called from any thread. Wakes the consumer if it is parked.
+    void enqueue(T* entry)
+    {
+        push(entry);
+        notify();
+    }
+
+    /// Insert a chain of elements already linked through their next_ pointers (first to last),
+    /// with a single atomic exchange and at most one wakeup.
+    void enqueue_chain(T* first, T* last)
+    {
+        last->next_.store(nullptr, std::memory_order_relaxed);
+        mpsc_node* prev = head_.exchange(last);
+        prev->next_.store(first, std::memory_order_release);
+        notify();
+    }
+
+    /// Wake the consumer if it is parked, returns true if it was.
+    /// Used when work for the consumer was published outside the queue (see dequeue(ready)).
+    bool notify()
+    {
+        if (sleeping_.load() && sleeping_.exchange(0))
+        {
+            wake();
+            return true;
+        }
+        return false;
+    }
+
+    /// Get/remove element from queue, returns nullptr if the queue is empty.
+    /// Must be called only from the consumer thread.
+    T* try_dequeue()
+    {
+        mpsc_node* tail = tail_;
+        mpsc_node* next = tail->next_.load(std::memory_order_acquire);
+
+        if (&stub_ == tail)
+        {
+            if (nullptr == next)
+                return nullptr;
+            tail_ = next;
+            tail = next;
+            next = next->next_.load(std::memory_order_acquire);
+        }
+
+        if (next)
+        {
+            tail_ = next;
+            return static_cast<T*>(tail);
+        }
+
+        // a producer is in the middle of an enqueue(), element will be visible shortly
+        if (tail != head_.load(std::memory_order_acquire))
+            return nullptr;
+
+        push(&stub_);
+        next = tail->next_.load(std::memory_order_acquire);
+        if (next)
+        {
+            tail_ = next;
+            return static_cast<T*>(tail);
+        }
+        return nullptr;
+    }
+
+    /// Get/remove element from queue, parks the calling thread if there are no elements into the queue.
+    /// Must be called only from the consumer thread.
+    T* dequeue()
+    {
+        return dequeue([]() { return false; });
+    }
+
+    /// Same as dequeue(), but returns nullptr instead of parking while ready() reports work available elsewhere.
+    /// Work published elsewhere must be counted in a seq_cst atomic checked by ready() before notify() is called.
+    template<typename Pred>
+    T* dequeue(Pred ready)
+    {
+        while (true)
+        {
+            T* entry = try_dequeue();
+            if (entry)
+                return entry;
+
+            if (ready())
+                return nullptr;
+
+            // spin a while before parking, a producer may be just completing its enqueue()
+            for (int spin = 0; spin < s_spin_count && empty(); spin++)
+                cpu_relax();
+
+            if (!empty())
+                continue;
+
+            // announce sleeping and check again, enqueue() pairs the head exchange with a sleeping_ load
+            sleeping_.store(1);
+            if (!empty() || ready())
+            {
+                sleeping_.store(0);
+                continue;
+            }
+            park();
+            sleeping_.store(0);
+        }
+    }
+
+    /// Check if there are no elements into the queue, reliable only from the consumer thread.
+    bool empty() const
+    {
+        return head_.load() == tail_;
+    }
+
+private:
+
+    mpsc_queue(const mpsc_queue&) = delete;
+    mpsc_queue& operator=(const mpsc_queue&) = delete;
+
+    static const int s_spin_count = 128;
+
+    void push(mpsc_node* node)
+    {
+        node->next_.store(nullptr, std::memory_order_relaxed);
+        mpsc_node* prev = head_.exchange(node);
+        prev->next_.store(node, std::memory_order_release);
+    }
+
+    static void cpu_relax()
+    {
+#if defined(__i386__) || defined(__x86_64__)
+        __builtin_ia32_pause();
+#endif
+    }
+
+#if defined(__linux__)
+    void park()
+    {
+        syscall(SYS_futex, reinterpret_cast<int*>(&sleeping_), FUTEX_WAIT_PRIVATE, 1, nullptr, nullptr, 0);
+    }
+
+    void wake()
+    {
+        syscall(SYS_futex, reinterpret_cast<int*>(&sleeping_), FUTEX_WAKE_PRIVATE, 1, nullptr, nullptr, 0);
+    }
+#else
+    void park()
+    {
+        boost::unique_lock<boost::mutex> lock_guard(mutex_lock_);
+        while (sleeping_.load())
+            condvar_.wait(lock_guard);
+    }
+
+    void wake()
+    {
+        boost::unique_lock<boost::mutex> lock_guard(mutex_lock_);
+        condvar_.notify_one();
+    }
+
+    boost::mutex mutex_lock_;
+    boost::condition_variable condvar_;
+#endif
+
+    // producers and consumer side are kept on separate cache lines
+    std::atomic<mpsc_node*> head_;
+    char pad_[64 - sizeof(std::atomic<mpsc_node*>)];
+    mpsc_node* tail_;
+    std::atomic<int> sleeping_;
+    mpsc_node stub_;
+};
+
+}
+#endif /* MPSC_QUEUE_H_ */
@@ -22,6 +22,12 @@ public:
         func_(this, sock);
     }
 
+    /// Close all connections of the service, called before the worker threads are stopped.
+    void stop()
+    {
+        stop_func_(this);
+    }
+
     /// Factory method.
     /// objects from this class will not be created directly but from a reg_factory<> instance.
     static net_service_base* create_object() { return NULL; }
@@ -29,15 +35,17 @@ public:
 protected:
 
     typedef void (*accept_func)(net_service_base*, tcp_socket_ptr);
-    net_service_base(accept_func func) : func_(func)
+    typedef void (*stop_func)(net_service_base*);
+    net_service_base(accept_func func, stop_func stop) : func_(func), stop_func_(stop)
     {}
 
     accept_func func_;
+    stop_func stop_func_;
 };
 
 /// A Curiously recurring template pattern for creating custom net service objects.
 /// ServiceImpl template is the actual service implementation.
-/// A custom implementation must implement an accept() method and an factory class that complies with reg_factory.
+/// A custom implementation must implement accept() and stop() methods and an factory class that complies with reg_factory.
 template<typename ServiceImpl>
 class net_service_impl : public net_service_base
 {
@@ -48,7 +56,13 @@ public:
         service->impl_.accept(sock);
     }
 
-    net_service_impl(ServiceImpl& impl) : net_service_base(&net_service_impl::handle_accept), impl_(impl)
+    static void handle_stop(net_service_base* base)
+    {
+        net_service_impl<ServiceImpl>* service(static_cast<net_service_impl<ServiceImpl>*>(base));
+        service->impl_.stop();
+    }
+
+    net_service_impl(ServiceImpl& impl) : net_service_base(&net_service_impl::handle_accept, &net_service_impl::handle_stop), impl_(impl)
     {}
 private:
     ServiceImpl& impl_;
@@ -7,10 +7,12 @@
 #define _NET_SERVICE_HELPERS_H_
 
 #include <boost/asio.hpp>
+#include <atomic>
 #include <memory>
-#include <map>
+#include <vector>
 
 #include "thread_wrapper.h"
+#include "async_task.h"
 #include "snode_core.h"
 #include "snode_types.h"
 
@@ -26,28 +28,33 @@ class net_service_listener_base
 public:
     void on_accept(tcp_socket_ptr sock) { func_(this, sock); }
 
+    /// Drop all connections of the listener, called on the listener's thread.
+    void on_stop() { stop_func_(this); }
+
     /// Get associated thread id with the listener
     const thread_id_t& thread_id() { return thread_id_; }
 protected:
     typedef void (*on_accept_func)(net_service_listener_base*, tcp_socket_ptr);
-    net_service_listener_base(on_accept_func func, thread_id_t id) : thread_id_(id), func_(func)
+    typedef void (*on_stop_func)(net_service_listener_base*);
+    net_service_listener_base(on_accept_func func, on_stop_func stop, thread_id_t id) : thread_id_(id), func_(func), stop_func_(stop)
     {}
 
 private:
     thread_id_t thread_id_;
     on_accept_func func_;
+    on_stop_func stop_func_;
 };
 
 typedef std::shared_ptr<net_service_listener_base> net_service_listener_base_ptr;
 
 /// (Listener) net_service_listener implementation.
-/// Listener implementation must have do_accept(tcp_socket_ptr) method implemented and to be copy constructive.
+/// Listener implementation must have do_accept(tcp_socket_ptr) and do_stop() methods implemented and to be copy constructive.
 template <typename Listener>
 class net_service_listener : public net_service_listener_base
 {
 public:
     net_service_listener(Listener impl, thread_id_t id)
-     : net_service_listener_base(&net_service_listener::on_accept_impl, id), impl_(impl)
+     : net_service_listener_base(&net_service_listener::on_accept_impl, &net_service_listener::on_stop_impl, id), impl_(impl)
     {}
 
     static void on_accept_impl(net_service_listener_base* base, tcp_socket_ptr sock)
@@ -56,29 +63,35 @@ public:
         listener->impl_.do_accept(sock);
     }
 
+    static void on_stop_impl(net_service_listener_base* base)
+    {
+        net_service_listener<Listener>* listener(static_cast<net_service_listener<Listener>*>(base));
+        listener->impl_.do_stop();
+    }
+
 private:
     Listener impl_;
 };
 
 /// Helper factory to ease the listener => thread_id mapping and object construction.
 /// Creates thread workers for a net_service.
+/// Listeners are indexed by the threadpool's worker index.
 /// ServiceListener is the template argument for creating the listener objects.
 template <typename ServiceListener>
 class net_service_listener_factory
 {
 public:
-    net_service_listener_factory() : last_used_(-1)
+    net_service_listener_factory() : next_(0)
     {
-        auto threads = snode_core::instance().get_threadpool().threads();
-        auto thread_count = threads.size();
+        const std::vector<thread_ptr>& threads = snode_core::instance().get_threadpool().threads();
 
         // map every listener with a worker thread id
-        for (int idx = 0; idx < thread_count; idx++)
+        for (std::size_t idx = 0; idx < threads.size(); idx++)
         {
             ServiceListener impl;
-            listeners_[idx] = std::make_shared<
-                                  net_service_listener
-                                      <ServiceListener> >(impl, threads[idx]->get_id());
+            listeners_.push_back(std::make_shared<
+                                     net_service_listener
+                                         <ServiceListener> >(impl, threads[idx]->get_id()));
         }
     }
 
@@ -86,43 +99,42 @@ public:
     /// If there is no match for this id a runtime error exception is thrown
     net_service_listener_base_ptr get_listener(thread_id_t id)
     {
-        auto threads = snode_core::instance().get_threadpool().threads();
-        auto thread_count = threads.size();
+        return get_listener(snode_core::instance().get_threadpool().worker_index(id));
+    }
 
-        for (int idx = 0; idx < thread_count; idx++)
+    /// Get listener for the worker with the given index.
+    /// If there is no such worker a runtime error exception is thrown
+    net_service_listener_base_ptr get_listener(std::size_t index)
+    {
+        if (index >= listeners_.size())
         {
-            if (threads[idx]->get_id() == id)
-            {
-                last_used_ = idx;
-                return listeners_[idx];
-            }
+            // no thread id found with the given id
+            throw std::runtime_error(s_listener_factory_msg);
         }
-        // no thread id found with the given id
-        throw std::runtime_error(s_listener_factory_msg);
+        return listeners_[index];
     }
 
-    /// Round robin mechanism for fetching a net_service_listener.
+    /// Drop the connections of every listener on its own thread,
+    /// the tasks run before any task scheduled later to the same workers (threadpool::stop()).
+    void stop()
+    {
+        for (auto listener : listeners_)
+            snode::async_task::connect(&net_service_listener_base::on_stop, listener, listener->thread_id());
+    }
+
+    /// Round robin mechanism for fetching a net_service_listener, can be called from any thread.
     net_service_listener_base_ptr get_next_listener()
     {
-        if (last_used_ < 0)
+        if (listeners_.empty())
         {
-            last_used_ = 0;
-        }
-        else
-        {
-            auto iter = listeners_.find(last_used_);
-
-            if ((++iter) != listeners_.end())
-                last_used_ = iter->first;
-            else
-                last_used_ = listeners_.begin()->first;
+            throw std::runtime_error(s_listener_factory_msg);
         }
-        return listeners_[last_used_];
+        return listeners_[next_++ % listeners_.size()];
     }
 
 protected:
-    int last_used_;
-    std::map<int, net_service_listener_base_ptr> listeners_;
+    std::atomic<std::size_t> next_; // sharded acceptors complete on several workers at once
+    std::vector<net_service_listener_base_ptr> listeners_;
 };
 
 }
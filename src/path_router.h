@@ -0,0 +1,209 @@
+//
+// path_router.h
+// Copyright (C) 2015  Emil Penchev, Bulgaria
+//
+
+#ifndef PATH_ROUTER_H_
+#define PATH_ROUTER_H_
+
+#include <map>
+#include <string>
+#include <vector>
+#include <cstdint>
+#include <algorithm>
+#include <boost/utility/string_ref.hpp>
+
+#include "uri_utils.h"
+
+namespace snode
+{
+
+/// Maps URL path prefixes to values (request handlers) with longest prefix matching over path segments.
+/// Paths are registered with add(), compile() then lays the trie out in flat arrays, children of a node are
+/// contiguous and sorted so a segment is found by a binary search. match() works on the raw request URL
+/// and does not allocate. Empty segments are ignored, "/a//b/" is the same path as "/a/b".
+template<typename T>
+class path_router
+{
+public:
+    path_router() : compiled_(true)
+    {
+        build_.push_back(build_node());
+    }
+
+    /// Register value for the given path prefix, returns false if the path is already registered.
+    /// Must be followed by compile() before the next match().
+    bool add(boost::string_ref path, const T& value)
+    {
+        uint32_t current = 0;
+        for (size_t pos = next_segment(path, 0); pos < path.size(); )
+        {
+            size_t end = segment_end(path, pos);
+            std::string segment(path.data() + pos, end - pos);
+
+            auto it = build_[current].children_.find(segment);
+            if (build_[current].children_.end() == it)
+            {
+                uint32_t child = static_cast<uint32_t>(build_.size());
+                build_[current].children_[segment] = child;
+                build_.push_back(build_node());
+                current = child;
+            }
+            else
+            {
+                current = it->second;
+            }
+            pos = next_segment(path, end);
+        }
+
+        if (build_[current].value_ != s_no_value)
+            return false;
+
+        build_[current].value_ = static_cast<int32_t>(values_.size());
+        values_.push_back(value);
+        compiled_ = false;
+        return true;
+    }
+
+    /// Lay out the registered paths for matching.
+    void compile()
+    {
+        nodes_.clear();
+        labels_.clear();
+        nodes_.reserve(build_.size());
+
+        // breadth first, the children of each node get consecutive indexes
+        std::vector<uint32_t> order(1, 0);
+        nodes_.push_back(node());
+        nodes_[0].value_ = build_[0].value_;
+        for (size_t i = 0; i < order.size(); i++)
+        {
+            const build_node& b = build_[order[i]];
+            nodes_[i].first_child_ = static_cast<uint32_t>(nodes_.size());
+            nodes_[i].child_count_ = static_cast<uint32_t>(b.children_.size());
+            for (const auto& child : b.children_)
+            {
+                node n;
+                n.label_ = static_cast<uint32_t>(labels_.size());
+                n.label_size_ = static_cast<uint32_t>(child.first.size());
+                n.value_ = build_[child.second].value_;
+                labels_.append(child.first);
+                nodes_.push_back(n);
+                order.push_back(child.second);
+            }
+        }
+        compiled_ = true;
+    }
+
+    /// Find the value registered for the longest path prefix of url, nullptr if there is none.
+    /// url may be an absolute URL, the scheme and authority as well as the query and fragment are skipped.
+    const T* match(boost::string_ref url) const
+    {
+        if (!compiled_ || nodes_.empty())
+            return nullptr;
+
+        boost::string_ref path = url_path(url);
+        uint32_t current = 0;
+        int32_t best = nodes_[0].value_;
+
+        for (size_t pos = next_segment(path, 0); pos < path.size(); )
+        {
+            size_t end = segment_end(path, pos);
+            uint32_t child = find_child(nodes_[current], boost::string_ref(path.data() + pos, end - pos));
+            if (s_no_node == child)
+                break;
+
+            current = child;
+            if (nodes_[current].value_ != s_no_value)
+                best = nodes_[current].value_;
+            pos = next_segment(path, end);
+        }
+
+        return s_no_value == best ? nullptr : &values_[static_cast<size_t>(best)];
+    }
+
+    /// Number of registered paths.
+    size_t size() const
+    {
+        return values_.size();
+    }
+
+    /// Path portion of a request URL, without the scheme, authority, query and fragment.
+    /// Malformed URLs have no path and match only the handler of "/".
+    static boost::string_ref url_path(boost::string_ref url)
+    {
+        uri_components components;
+        return components.parse(url) ? components.path() : boost::string_ref();
+    }
+
+private:
+
+    static const int32_t s_no_value = -1;
+    static const uint32_t s_no_node = static_cast<uint32_t>(-1);
+
+    struct build_node
+    {
+        build_node() : value_(s_no_value) {}
+
+        std::map<std::string, uint32_t> children_;
+        int32_t value_;
+    };
+
+    struct node
+    {
+        node() : label_(0), label_size_(0), first_child_(0), child_count_(0), value_(s_no_value) {}
+
+        uint32_t label_;        // offset into labels_
+        uint32_t label_size_;
+        uint32_t first_child_;
+        uint32_t child_count_;
+        int32_t value_;         // index into values_
+    };
+
+    boost::string_ref label(const node& n) const
+    {
+        return boost::string_ref(labels_.data() + n.label_, n.label_size_);
+    }
+
+    uint32_t find_child(const node& parent, boost::string_ref segment) const
+    {
+        // children are sorted the way std::map<std::string> orders them
+        uint32_t low = parent.first_child_;
+        uint32_t high = parent.first_child_ + parent.child_count_;
+        while (low < high)
+        {
+            uint32_t mid = low + (high - low) / 2;
+            int cmp = label(nodes_[mid]).compare(segment);
+            if (0 == cmp)
+                return mid;
+            if (cmp < 0)
+                low = mid + 1;
+            else
+                high = mid;
+        }
+        return s_no_node;
+    }
+
+    static size_t next_segment(boost::string_ref path, size_t pos)
+    {
+        while (pos < path.size() && '/' == path[pos])
+            pos++;
+        return pos;
+    }
+
+    static size_t segment_end(boost::string_ref path, size_t pos)
+    {
+        while (pos < path.size() && path[pos] != '/')
+            pos++;
+        return pos;
+    }
+
+    bool compiled_;
+    std::vector<build_node> build_;
+    std::vector<node> nodes_;
+    std::string labels_;
+    std::vector<T> values_;
+};
+
+}
+#endif /* PATH_ROUTER_H_ */
@@ -14,6 +14,7 @@
 #include "async_streams.h"
 #include "async_task.h"
 #include "async_op.h"
+#include "slab_allocator.h"
 #include "thread_wrapper.h"
 
 namespace snode
@@ -23,12 +24,15 @@ namespace streams
 {
     /// Serves as a memory-based stream buffer that supports both writing
     /// and reading sequences of characters at the same time. It can be used as a consumer/producer buffer.
-    template<typename TChar>
-    class producer_consumer_buffer : public async_streambuf<TChar, producer_consumer_buffer<TChar> >
+    /// (TLock) guards the buffer state. With the default lib::null_mutex the producer and the consumer must run
+    /// on the same worker. With a real mutex (see concurrent_buffer) they can run on different workers and use
+    /// the buffer directly, every completion is scheduled on the worker that started the operation.
+    template<typename TChar, typename TLock = lib::null_mutex>
+    class producer_consumer_buffer : public async_streambuf<TChar, producer_consumer_buffer<TChar, TLock> >
     {
     public:
         typedef TChar char_type;
-        typedef async_streambuf<TChar, producer_consumer_buffer<TChar> > base_streambuf_type;
+        typedef async_streambuf<TChar, producer_consumer_buffer<TChar, TLock> > base_streambuf_type;
         typedef typename producer_consumer_buffer::traits traits;
         typedef typename producer_consumer_buffer::pos_type pos_type;
         typedef typename producer_consumer_buffer::int_type int_type;
@@ -37,9 +41,10 @@ namespace streams
         /// Default constructor accepts allocation size in bytes for the internal memory blocks.
         producer_consumer_buffer(size_t alloc_size = 512) : base_streambuf_type(std::ios_base::out | std::ios_base::in),
             alloc_size_(alloc_size),
-            allocblock_(nullptr),
+            allocblock_(nullptr), alloc_in_tail_(false),
             total_(0), total_read_(0), total_written_(0),
-            synced_(0)
+            synced_(0),
+            high_(0), low_(0)
         {}
 
         /// Destructor
@@ -47,20 +52,19 @@ namespace streams
         {
             this->close();
             blocks_.clear();
+            free_blocks_.clear();
         }
 
         /// helper function for instance creation
-        static async_streambuf<TChar, producer_consumer_buffer<TChar> >*
-        create_instance(size_t alloc_size = 512)
+        static base_streambuf_type* create_instance(size_t alloc_size = 512)
         {
             return new producer_consumer_buffer(alloc_size);
         }
 
-        /// helper function for shared instance creation
-        static std::shared_ptr<async_streambuf<TChar, producer_consumer_buffer<TChar> > >
-        create_shared_instance(size_t alloc_size = 512)
+        /// helper function for shared instance creation, the buffer comes from the calling worker's slab cache.
+        static std::shared_ptr<base_streambuf_type> create_shared_instance(size_t alloc_size = 512)
         {
-            return std::make_shared<producer_consumer_buffer<TChar> >(alloc_size);
+            return std::allocate_shared<producer_consumer_buffer>(pool_allocator<producer_consumer_buffer>(), alloc_size);
         }
 
         /// checks if stream buffer supports seeking.
@@ -72,12 +76,17 @@ namespace streams
         /// For any input stream,
         /// returns the number of characters that are immediately available to be consumed without blocking.
         /// For details see async_streambuf::in_avail()
-        size_t in_avail() const { return total_; }
+        size_t in_avail() const
+        {
+            lock_type lock(mutex_);
+            return total_;
+        }
 
         /// Gets the current read or write position in the stream for the given (direction).
         /// For details see async_streambuf::getpos()
         pos_type getpos(std::ios_base::openmode mode) const
         {
+            lock_type lock(mutex_);
             if ( ((mode & std::ios_base::in) && !this->can_read()) ||
                  ((mode & std::ios_base::out) && !this->can_write()))
             {
@@ -93,20 +102,19 @@ namespace streams
         }
 
         /// Allocates a contiguous block of memory of (count) bytes and returns it.
+        /// The space is taken from the write block if it fits, otherwise from a new or a recycled block.
         /// For details see async_streambuf::alloc()
         char_type* alloc(size_t count)
         {
+            lock_type lock(mutex_);
             if (!this->can_write())
             {
                 return nullptr;
             }
 
-            // We always allocate a new block even if the count could be satisfied by
-            // the current write block. While this does lead to wasted space it allows for
-            // easier book keeping
-
             assert(!allocblock_);
-            allocblock_ = std::make_shared<mem_block>(count);
+            alloc_in_tail_ = !blocks_.empty() && blocks_.back()->wr_chars_left() >= count;
+            allocblock_ = alloc_in_tail_ ? blocks_.back() : new_block(count);
             return allocblock_->wbegin();
         }
 
@@ -114,15 +122,28 @@ namespace streams
         /// For details see async_streambuf::commit()
         void commit(size_t count)
         {
-            // The count does not reflect the actual size of the block.
-            // Since we do not allow any more writes to this block it would suffice.
-            // If we ever change the algorithm to reuse blocks then this needs to be revisited.
-
+            lock_type lock(mutex_);
             assert((bool)allocblock_);
-            allocblock_->update_write_head(count);
-            blocks_.push_back(allocblock_);
+
+            // Only the (count) committed characters become readable, the rest of the space stays with the block.
+            // The block pointer is dropped before the readers run so that drained blocks can be recycled.
+            auto block = std::move(allocblock_);
             allocblock_ = nullptr;
+            if (alloc_in_tail_ && block->rd_chars_left() && blocks_.back() != block)
+            {
+                // Data written since alloc() went to a newer block, the committed data must follow it.
+                // The old block stays in the list until it is read, its free space is copied now.
+                const char_type* data = block->wbegin();
+                block.reset();
+                write(data, count);
+                return;
+            }
 
+            // The tail block, a new block, or the tail block drained and purged by the reader meanwhile.
+            if (blocks_.empty() || blocks_.back() != block)
+                blocks_.push_back(block);
+            block->update_write_head(count);
+            block.reset();
             update_write_head(count);
         }
 
@@ -130,6 +151,7 @@ namespace streams
         /// For details see async_streambuf::acquire()
         bool acquire(char_type*& ptr, size_t& count)
         {
+            lock_type lock(mutex_);
             count = 0;
             ptr = nullptr;
 
@@ -143,7 +165,7 @@ namespace streams
             }
             else
             {
-                auto block = blocks_.front();
+                const auto& block = blocks_.front();
 
                 count = block->rd_chars_left();
                 ptr = block->rbegin();
@@ -160,18 +182,125 @@ namespace streams
             if (ptr == nullptr)
                 return;
 
-            auto block = blocks_.front();
+            lock_type lock(mutex_);
+
+            // no copy of the block pointer is held while update_read_head() recycles it
+            assert(blocks_.front()->rd_chars_left() >= count);
+            blocks_.front()->read_ += count;
+
+            update_read_head(count);
+        }
+
+        /// Contiguous run of data in one of the memory blocks, see acquire_blocks().
+        struct block_span
+        {
+            const char_type* ptr_;
+            size_t count_;
+        };
+
+        /// Gets the data already written to up to (max_spans) memory blocks, (max_count) characters in total,
+        /// without copying it. The data stays valid until it is released with release_blocks(), the writer may
+        /// append meanwhile. Returns the number of spans filled.
+        size_t acquire_blocks(block_span* spans, size_t max_spans, size_t max_count)
+        {
+            lock_type lock(mutex_);
+            if (!this->can_read())
+                return 0;
+
+            size_t n = 0;
+            for (auto iter = blocks_.begin(); iter != blocks_.end() && n < max_spans && max_count; ++iter)
+            {
+                size_t count = std::min((*iter)->rd_chars_left(), max_count);
+                if (!count)
+                    continue;
+
+                spans[n].ptr_ = (*iter)->rbegin();
+                spans[n].count_ = count;
+                max_count -= count;
+                n++;
+            }
+            return n;
+        }
 
-            assert(block->rd_chars_left() >= count);
-            block->read_ += count;
+        /// Releases (count) characters acquired using acquire_blocks() and moves the read position ahead.
+        void release_blocks(size_t count)
+        {
+            lock_type lock(mutex_);
+            assert(count <= total_);
 
+            size_t left = count;
+            for (auto iter = blocks_.begin(); iter != blocks_.end() && left; ++iter)
+            {
+                size_t released = std::min((*iter)->rd_chars_left(), left);
+                (*iter)->read_ += released;
+                left -= released;
+            }
             update_read_head(count);
         }
 
+        /// Waits until (count) characters can be read without blocking or the write head is closed, nothing is read.
+        /// The function signature of the handler must be: void handler(size_t count)
+        /// where count is the number of characters available, 0 if the end of the stream is reached.
+        template<typename THandler>
+        void wait_available(size_t count, THandler handler)
+        {
+            auto op = new async_streambuf_op<char_type, THandler>(handler);
+            enqueue_request(ev_request(*this, op, nullptr, count, ev_request::NoRead));
+        }
+
+        /// Sets the high and low watermarks of the buffered data. Once (high) characters are buffered the completions
+        /// of putc(), putn() and putn_nocopy() and the wait_for_space() handlers are held back until consumers drain
+        /// the buffer to (low) characters or less, so a producer waiting for its writes to complete is paced
+        /// by the consumers. The data itself is always accepted. A (high) of 0 removes the limit.
+        void set_watermarks(size_t high, size_t low)
+        {
+            lock_type lock(mutex_);
+            high_ = high;
+            low_ = std::min(low, high);
+            if (!full())
+                release_writers();
+        }
+
+        /// Number of drained memory blocks kept for reuse.
+        size_t free_blocks() const
+        {
+            lock_type lock(mutex_);
+            return free_blocks_.size();
+        }
+
+        /// Checks whether a high watermark is set.
+        bool has_watermarks() const
+        {
+            lock_type lock(mutex_);
+            return high_ != 0;
+        }
+
+        /// Checks whether the buffered data has reached the high watermark.
+        bool is_full() const
+        {
+            lock_type lock(mutex_);
+            return full();
+        }
+
+        /// Waits until the buffered data is below the high watermark, or drained to the low one if it has reached it.
+        /// For producers writing with alloc()/commit(). The function signature of the handler must be:
+        /// void handler(size_t count) where count is always 0.
+        template<typename THandler>
+        void wait_for_space(THandler handler)
+        {
+            auto op = new async_streambuf_op<char_type, THandler>(handler);
+            lock_type lock(mutex_);
+            if ((full() || !writers_.empty()) && this->can_read())
+                writers_.push_back(deferred_write(op, 0, 0, false));
+            else
+                async_task::connect(&async_streambuf_op_base<char_type>::complete_size, op, static_cast<size_t>(0));
+        }
+
         /// For output streams, flush any internally buffered data to the underlying medium.
         void sync()
         {
-            synced_ = this->in_avail();
+            lock_type lock(mutex_);
+            synced_ = total_;
             fulfill_outstanding();
         }
 
@@ -183,10 +312,10 @@ namespace streams
             auto op = new async_streambuf_op<char_type, THandler>(handler);
             auto write_fn = [](char_type ch,
                                async_streambuf_op_base<char_type>* op,
-                               producer_consumer_buffer<char_type>* buf)
+                               producer_consumer_buffer* buf)
             {
-                int_type res = (buf->write(&ch, 1) ? static_cast<int_type>(ch) : traits::eof());
-                op->complete_ch(res);
+                int_type res = (buf->write_locked(&ch, 1) ? static_cast<int_type>(ch) : traits::eof());
+                buf->complete_write(op, 0, res, true);
             };
             async_task::connect(write_fn, ch, op, this);
         }
@@ -203,10 +332,10 @@ namespace streams
 
             auto write_fn = [](std::shared_ptr<std::vector<char_type> > cpbuf,
                                async_streambuf_op_base<char_type>* op,
-                               producer_consumer_buffer<char_type>* buf)
+                               producer_consumer_buffer* buf)
             {
-                size_t res = buf->write(cpbuf->data(), cpbuf->size());
-                op->complete_size(res);
+                size_t res = buf->write_locked(cpbuf->data(), cpbuf->size());
+                buf->complete_write(op, res);
             };
             async_task::connect(write_fn, cpbuf, op, this);
         }
@@ -218,10 +347,10 @@ namespace streams
         {
             auto op = new async_streambuf_op<char_type, THandler>(handler);
             auto write_fn = [](const char_type* ptr, size_t count,
-                               async_streambuf_op_base<char_type>* op, producer_consumer_buffer<char_type>* buf)
+                               async_streambuf_op_base<char_type>* op, producer_consumer_buffer* buf)
             {
-                size_t res = buf->write(ptr, count);
-                op->complete_size(res);
+                size_t res = buf->write_locked(ptr, count);
+                buf->complete_write(op, res);
             };
             async_task::connect(write_fn, ptr, count, op, this);
         }
@@ -239,6 +368,7 @@ namespace streams
         /// For details see async_streambuf::sgetn()
         size_t sgetn(char_type* ptr, size_t count)
         {
+            lock_type lock(mutex_);
             return can_satisfy(count) ? this->read(ptr, count) : (size_t)traits::requires_async();
         }
 
@@ -246,6 +376,7 @@ namespace streams
         /// For details see async_streambuf::scopy()
         size_t scopy(char_type* ptr, size_t count)
         {
+            lock_type lock(mutex_);
             return can_satisfy(count) ? this->read(ptr, count, false) : (size_t)traits::requires_async();
         }
 
@@ -262,6 +393,7 @@ namespace streams
         /// For details see async_streambuf::sbumpc()
         int_type sbumpc()
         {
+            lock_type lock(mutex_);
             return can_satisfy(1) ? this->read_byte(true) : traits::requires_async();
         }
 
@@ -278,6 +410,7 @@ namespace streams
         /// For details see async_streambuf::sgetc()
         int_type sgetc()
         {
+            lock_type lock(mutex_);
             return can_satisfy(1) ? this->read_byte(false) : traits::requires_async();
         }
 
@@ -301,12 +434,17 @@ namespace streams
         /// Close for reading
         void close_read()
         {
+            lock_type lock(mutex_);
             this->stream_can_read_ = false;
+            // nobody will drain the buffer
+            release_writers();
         }
 
         /// Close for writing
         void close_write()
         {
+            lock_type lock(mutex_);
+
             // First indicate that there could be no more writes.
             // Fulfill outstanding relies on that to flush all the
             // read requests.
@@ -314,21 +452,25 @@ namespace streams
 
             // This runs on the thread that called close.
             this->fulfill_outstanding();
+            release_writers();
         }
 
     private:
+        typedef lib::lock_guard<TLock> lock_type;
+
         /// Represents a memory block
         class mem_block
         {
         public:
             mem_block(size_t size)
-                : read_(0), pos_(0), size_(size), data_(new char_type[size])
+                : read_(0), pos_(0), size_(size),
+                  data_(static_cast<char_type*>(slab_allocator::allocate(size * sizeof(char_type))))
             {
             }
 
             ~mem_block()
             {
-                delete [] data_;
+                slab_allocator::deallocate(data_, size_ * sizeof(char_type));
             }
 
             // Read head
@@ -415,14 +557,15 @@ namespace streams
         class ev_request
         {
         public:
-            enum AdvanceAction { AdvanceOnce = 1, AdvanceBefore = 2, NoAdvance = 3 };
+            enum AdvanceAction { AdvanceOnce = 1, AdvanceBefore = 2, NoAdvance = 3, NoRead = 4 };
 
-            ev_request(producer_consumer_buffer<char_type>& streambuf,
+            ev_request(producer_consumer_buffer& streambuf,
                        async_streambuf_op_base<char_type>* op,
                        char_type* ptr = nullptr,
                        size_t count = 1,
                        AdvanceAction advance = AdvanceOnce)
-            : count_(count), advance_act_(advance), bufptr_(ptr), streambuf_(streambuf), completion_op_(op)
+            : count_(count), advance_act_(advance), bufptr_(ptr), streambuf_(streambuf), completion_op_(op),
+              thread_id_(THIS_THREAD_ID())
             {}
 
             size_t size() const
@@ -430,16 +573,34 @@ namespace streams
                 return count_;
             }
 
+            /// Worker which made the request, the completion runs there.
+            thread_id_t thread_id() const
+            {
+                return thread_id_;
+            }
+
             void complete()
             {
-                if (count_ > 1 && bufptr_ != nullptr)
+                task_batch batch;
+                complete(batch);
+                async_task::connect_batch(batch, thread_id_);
+            }
+
+            /// Consume the data and add the completion to a batch, to be scheduled together with other completions.
+            void complete(task_batch& batch)
+            {
+                if (NoRead == advance_act_)
+                {
+                    batch.add(std::bind(&async_streambuf_op_base<char_type>::complete_size, completion_op_, streambuf_.total_));
+                }
+                else if (count_ > 1 && bufptr_ != nullptr)
                 {
                     bool advance = true;
                     if (NoAdvance == advance_act_)
                         advance = false;
 
                     size_t countread = streambuf_.read(bufptr_, count_, advance);
-                    async_task::connect(&async_streambuf_op_base<char_type>::complete_size, completion_op_, countread);
+                    batch.add(std::bind(&async_streambuf_op_base<char_type>::complete_size, completion_op_, countread));
                 }
                 else
                 {
@@ -450,7 +611,7 @@ namespace streams
                         streambuf_.read_byte(true);
 
                     int_type value = streambuf_.read_byte(advance);
-                    async_task::connect(&async_streambuf_op_base<char_type>::complete_ch, completion_op_, value);
+                    batch.add(std::bind(&async_streambuf_op_base<char_type>::complete_ch, completion_op_, value));
                 }
             }
 
@@ -458,10 +619,69 @@ namespace streams
             size_t count_;
             AdvanceAction advance_act_;
             char_type* bufptr_;
-            producer_consumer_buffer<char_type>& streambuf_;
+            producer_consumer_buffer& streambuf_;
             async_streambuf_op_base<char_type>* completion_op_;
+            thread_id_t thread_id_;
+        };
+
+        /// Producer write completion held back by the high watermark.
+        struct deferred_write
+        {
+            deferred_write(async_streambuf_op_base<char_type>* op, size_t count, int_type ch, bool is_char)
+                : op_(op), count_(count), ch_(ch), is_char_(is_char), thread_id_(THIS_THREAD_ID())
+            {}
+
+            async_streambuf_op_base<char_type>* op_;
+            size_t count_;
+            int_type ch_;
+            bool is_char_;
+            thread_id_t thread_id_;     // worker of the producer
         };
 
+        /// Complete a producer write, or hold the completion back if the high watermark is reached.
+        /// The handler runs without the lock, it may write again.
+        void complete_write(async_streambuf_op_base<char_type>* op, size_t count, int_type ch = 0, bool is_char = false)
+        {
+            {
+                lock_type lock(mutex_);
+                if ((full() || !writers_.empty()) && this->can_read() && this->can_write())
+                {
+                    writers_.push_back(deferred_write(op, count, ch, is_char));
+                    return;
+                }
+            }
+
+            if (is_char)
+                op->complete_ch(ch);
+            else
+                op->complete_size(count);
+        }
+
+        /// Schedule the held back write completions on the producers' workers.
+        void release_writers()
+        {
+            if (writers_.empty())
+                return;
+
+            task_batch batch;
+            thread_id_t id = writers_.front().thread_id_;
+            for (const auto& writer : writers_)
+            {
+                if (writer.thread_id_ != id)
+                {
+                    async_task::connect_batch(batch, id);
+                    id = writer.thread_id_;
+                }
+
+                if (writer.is_char_)
+                    batch.add(std::bind(&async_streambuf_op_base<char_type>::complete_ch, writer.op_, writer.ch_));
+                else
+                    batch.add(std::bind(&async_streambuf_op_base<char_type>::complete_size, writer.op_, writer.count_));
+            }
+            writers_.clear();
+            async_task::connect_batch(batch, id);
+        }
+
         /// Updates the write head by an offset specified by count
         /// This should be called with the lock held.
         void update_write_head(size_t count)
@@ -481,16 +701,14 @@ namespace streams
             if (!this->can_read())
                 return count;
 
-            // Allocate a new block if necessary
-            if ( blocks_.empty() || blocks_.back()->wr_chars_left() < count )
+            // Allocate a new block if necessary, the space handed out by alloc() is not written over
+            if ( blocks_.empty() || blocks_.back() == allocblock_ || blocks_.back()->wr_chars_left() < count )
             {
-                size_t alloc_size = std::max(count, alloc_size_);
-                blocks_.push_back(std::make_shared<mem_block>((size_t)alloc_size));
+                blocks_.push_back(new_block(count));
             }
 
             // The block at the back is always the write head
-            auto last = blocks_.back();
-            auto written = last->write(ptr, count);
+            auto written = blocks_.back()->write(ptr, count);
             assert(written == count);
 
             update_write_head(written);
@@ -500,14 +718,16 @@ namespace streams
         /// Writes count characters from ptr into the stream buffer
         size_t write_locked(const char_type* ptr, size_t count)
         {
-            // disabled for now            
-            // lib::lock_guard<lib::recursive_mutex> lockg(mutex_);
+            lock_type lock(mutex_);
             return this->write(ptr, count);
         }
 
-        /// Fulfill pending requests
+        /// Fulfill pending requests, the completions for this worker are scheduled together as one batch,
+        /// requests made on other workers are completed there.
         void fulfill_outstanding()
         {
+            task_batch batch;
+            thread_id_t id = THIS_THREAD_ID();
             while (!requests_.empty())
             {
                 auto req = requests_.front();
@@ -515,18 +735,25 @@ namespace streams
                 // If we cannot satisfy the request then we need
                 // to wait for the producer to write data
                 if (!can_satisfy(req.size()))
-                    return;
+                    break;
 
                 // We have enough data to satisfy this request
-                req.complete();
+                if (req.thread_id() == id)
+                    req.complete(batch);
+                else
+                    req.complete();
 
                 // Remove it from the request queue
                 requests_.pop();
             }
+
+            if (!batch.empty())
+                async_task::connect_batch(batch, id);
         }
 
         void enqueue_request(ev_request req)
         {
+            lock_type lock(mutex_);
             if (can_satisfy(req.size()))
             {
                 // We can immediately fulfill the request.
@@ -540,11 +767,15 @@ namespace streams
         }
 
         /// Determine if the request can be satisfied.
+        /// Any read is satisfied while the producer is held back by the watermarks, it waits for the buffer to drain.
         bool can_satisfy(size_t count)
         {
-            return (synced_ > 0) || (this->in_avail() >= count) || !this->can_write();
+            return (synced_ > 0) || (total_ >= count) || !this->can_write() || full() || !writers_.empty();
         }
 
+        /// Checks whether the buffered data has reached the high watermark, with the lock held.
+        bool full() const { return high_ && total_ >= high_; }
+
         /// Reads a byte from the stream and returns it as int_type.
         /// Note: This routine shall only be called if can_satisfy() returned true.
         int_type read_byte(bool advance = true)
@@ -565,8 +796,7 @@ namespace streams
 
             for (auto iter = begin(blocks_); iter != std::end(blocks_); ++iter)
             {
-                auto block = *iter;
-                auto read_from_block = block->read(ptr + totalr, count - totalr, advance);
+                auto read_from_block = (*iter)->read(ptr + totalr, count - totalr, advance);
 
                 totalr += read_from_block;
 
@@ -583,6 +813,32 @@ namespace streams
             return totalr;
         }
 
+        /// Gets an empty block for at least (count) characters, a recycled one if it is large enough.
+        std::shared_ptr<mem_block> new_block(size_t count)
+        {
+            for (auto iter = free_blocks_.begin(); iter != free_blocks_.end(); ++iter)
+            {
+                if ((*iter)->size_ >= count)
+                {
+                    auto block = *iter;
+                    free_blocks_.erase(iter);
+                    return block;
+                }
+            }
+            return std::allocate_shared<mem_block>(pool_allocator<mem_block>(), std::max(count, alloc_size_));
+        }
+
+        /// Keeps a drained block for reuse unless the free list is full or the block is still referenced
+        /// (a pending alloc()).
+        void recycle_block(const std::shared_ptr<mem_block>& block)
+        {
+            if (free_blocks_.size() >= s_max_free_blocks || block.use_count() > 1)
+                return;
+
+            block->read_ = block->pos_ = 0;
+            free_blocks_.push_back(block);
+        }
+
         /// Updates the read head by the specified offset
         /// This should be called with the lock held.
         void update_read_head(size_t count)
@@ -601,15 +857,20 @@ namespace streams
                 if (blocks_.front()->rd_chars_left() > 0) break;
 
                 // The block has no more data to be read. Release the block
+                recycle_block(blocks_.front());
                 blocks_.pop_front();
             }
+
+            if (!writers_.empty() && total_ <= low_)
+                release_writers();
         }
 
         // Default block size
         size_t alloc_size_;
 
-        // Block used for alloc/commit
+        // Block used for alloc/commit, the tail block if its free space was handed out
         std::shared_ptr<mem_block> allocblock_;
+        bool alloc_in_tail_;
 
         // Total available data
         size_t total_;
@@ -626,19 +887,33 @@ namespace streams
         // being what the buffer is for in the first place). Thus, we have to protect
         // against some of the internal data elements against concurrent accesses
         // and the possibility of inconsistent states. A simple non-recursive lock
-        // should be sufficient for those purposes if the buffer is to be accessed from different threads.
-
-        // global lock in case of using the write_locked and read_locked functions
-        // lib::recursive_mutex mutex_;
+        // is sufficient for those purposes if the buffer is to be accessed from different threads.
+        // Public functions take it, the private ones expect it held. Handlers never run with it held.
+        mutable TLock mutex_;
 
         // Memory blocks
         std::deque<std::shared_ptr<mem_block>> blocks_;
 
+        // Drained blocks kept for reuse, a steadily streaming buffer allocates none
+        static const size_t s_max_free_blocks = 4;
+        std::vector<std::shared_ptr<mem_block>> free_blocks_;
+
         // Queue of requests
         std::queue<ev_request> requests_;
 
+        // High and low watermarks of the buffered data, 0 if not limited
+        size_t high_;
+        size_t low_;
+
+        // Producer write completions waiting for the consumers to drain the buffer
+        std::vector<deferred_write> writers_;
+
     };
 
+    /// Producer consumer buffer for a producer and a consumer running on different workers.
+    template<typename TChar>
+    using concurrent_buffer = producer_consumer_buffer<TChar, lib::mutex>;
+
 }} // namespaces
 
 #endif /* _PRODUCER_CONSUMER_BUF_H_ */
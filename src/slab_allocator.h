@@ -0,0 +1,387 @@
+//
+// slab_allocator.h
+// Copyright (C) 2015  Emil Penchev, Bulgaria
+//
+
+#ifndef SLAB_ALLOCATOR_H_
+#define SLAB_ALLOCATOR_H_
+
+#include <new>
+#include <utility>
+#include <cstddef>
+#include <cstdint>
+#include <boost/thread/locks.hpp>
+#include <boost/thread/mutex.hpp>
+
+namespace snode
+{
+
+/// Slab allocator usage counters.
+struct slab_stats
+{
+    slab_stats() : hits(0), misses(0), oversize(0), releases(0)
+    {}
+
+    uint64_t hits;      /// allocations served from a thread cache or the shared depot (no malloc)
+    uint64_t misses;    /// allocations that fell back to the global heap
+    uint64_t oversize;  /// allocations bigger than the largest size class, always on the global heap
+    uint64_t releases;  /// deallocations that went back to the global heap because the caches were full
+};
+
+/// Size class allocator with thread local free lists, used for small short lived objects
+/// (task nodes, completion operations) that would otherwise hit malloc on every operation.
+/// Blocks are power of two sized from 32 bytes up to 16K, a block freed on any thread goes into that thread's cache.
+/// Objects are usually allocated on one thread and freed on another (a task posted to a worker),
+/// so a full cache hands a batch of blocks to a shared depot and an empty cache refills from it,
+/// the depot lock is taken once per batch. Depot is capped, the excess is returned to the global heap.
+/// Callers must pass the same size to deallocate() as to allocate().
+class slab_allocator
+{
+public:
+
+    static void* allocate(std::size_t size)
+    {
+        std::size_t index = size_class(size);
+        if (s_class_count == index)
+        {
+            thread_cache& cache = local_cache();
+            cache.counters_.oversize++;
+            return ::operator new(size);
+        }
+
+        thread_cache& cache = local_cache();
+        free_block* block = cache.free_[index];
+        if (block)
+        {
+            cache.free_[index] = block->next_;
+            cache.count_[index]--;
+            cache.counters_.hits++;
+            return block;
+        }
+
+        if (refill(cache, index))
+        {
+            block = cache.free_[index];
+            cache.free_[index] = block->next_;
+            cache.count_[index]--;
+            cache.counters_.hits++;
+            return block;
+        }
+
+        cache.counters_.misses++;
+        return ::operator new(class_size(index));
+    }
+
+    static void deallocate(void* pointer, std::size_t size)
+    {
+        if (!pointer)
+            return;
+
+        std::size_t index = size_class(size);
+        if (s_class_count == index)
+        {
+            ::operator delete(pointer);
+            return;
+        }
+
+        thread_cache& cache = local_cache();
+        free_block* block = static_cast<free_block*>(pointer);
+        block->next_ = cache.free_[index];
+        cache.free_[index] = block;
+        cache.count_[index]++;
+
+        if (cache.count_[index] >= class_limit(index))
+            flush(cache, index);
+    }
+
+    /// Get the counters summed over all threads, including the ones which already exited.
+    static slab_stats stats()
+    {
+        registry& reg = get_registry();
+        boost::lock_guard<boost::mutex> lock_guard(reg.lock_);
+        slab_stats result = reg.retired_;
+        for (thread_cache* cache = reg.caches_; cache; cache = cache->next_cache_)
+            add(result, cache->counters_);
+        return result;
+    }
+
+    /// Get the counters of the calling thread.
+    static slab_stats thread_stats()
+    {
+        return local_cache().counters_;
+    }
+
+    /// Largest size served from the thread caches.
+    static std::size_t max_size()
+    {
+        return class_size(s_class_count - 1);
+    }
+
+private:
+
+    static const std::size_t s_class_count = 10;       // 32 bytes .. 16K
+    static const std::size_t s_min_shift = 5;
+    static const std::size_t s_cache_bytes = 256 * 1024; // per size class and thread
+    static const std::size_t s_cache_max_blocks = 1024;
+    static const std::size_t s_batch_blocks = 64;       // blocks moved between a thread cache and the depot at once
+    static const std::size_t s_depot_max_batches = 256; // per size class
+
+    struct free_block
+    {
+        free_block* next_;
+    };
+
+    struct thread_cache;
+
+    struct registry
+    {
+        registry() : caches_(nullptr)
+        {
+            for (std::size_t i = 0; i < s_class_count; i++)
+                depot_count_[i] = 0;
+        }
+
+        boost::mutex lock_;
+        thread_cache* caches_;
+        slab_stats retired_;
+
+        // full batches of s_batch_blocks linked blocks, per size class
+        boost::mutex depot_lock_;
+        free_block* depot_[s_class_count][s_depot_max_batches];
+        std::size_t depot_count_[s_class_count];
+    };
+
+    struct thread_cache
+    {
+        thread_cache() : next_cache_(nullptr), prev_cache_(nullptr)
+        {
+            for (std::size_t i = 0; i < s_class_count; i++)
+            {
+                free_[i] = nullptr;
+                count_[i] = 0;
+            }
+
+            registry& reg = get_registry();
+            boost::lock_guard<boost::mutex> lock_guard(reg.lock_);
+            next_cache_ = reg.caches_;
+            if (next_cache_)
+                next_cache_->prev_cache_ = this;
+            reg.caches_ = this;
+        }
+
+        ~thread_cache()
+        {
+            for (std::size_t i = 0; i < s_class_count; i++)
+            {
+                while (free_[i])
+                {
+                    free_block* block = free_[i];
+                    free_[i] = block->next_;
+                    ::operator delete(block);
+                }
+            }
+
+            registry& reg = get_registry();
+            boost::lock_guard<boost::mutex> lock_guard(reg.lock_);
+            add(reg.retired_, counters_);
+            if (prev_cache_)
+                prev_cache_->next_cache_ = next_cache_;
+            else
+                reg.caches_ = next_cache_;
+            if (next_cache_)
+                next_cache_->prev_cache_ = prev_cache_;
+        }
+
+        free_block* free_[s_class_count];
+        std::size_t count_[s_class_count];
+        slab_stats counters_;
+        thread_cache* next_cache_;
+        thread_cache* prev_cache_;
+    };
+
+    /// Move a batch of blocks from the depot into an empty thread cache.
+    static bool refill(thread_cache& cache, std::size_t index)
+    {
+        registry& reg = get_registry();
+        boost::lock_guard<boost::mutex> lock_guard(reg.depot_lock_);
+        if (!reg.depot_count_[index])
+            return false;
+
+        cache.free_[index] = reg.depot_[index][--reg.depot_count_[index]];
+        cache.count_[index] = s_batch_blocks;
+        return true;
+    }
+
+    /// Move a batch of blocks from a full thread cache to the depot, or to the global heap if the depot is full.
+    static void flush(thread_cache& cache, std::size_t index)
+    {
+        free_block* batch = cache.free_[index];
+        free_block* last = batch;
+        for (std::size_t i = 1; i < s_batch_blocks; i++)
+            last = last->next_;
+        cache.free_[index] = last->next_;
+        cache.count_[index] -= s_batch_blocks;
+        last->next_ = nullptr;
+
+        {
+            registry& reg = get_registry();
+            boost::lock_guard<boost::mutex> lock_guard(reg.depot_lock_);
+            if (reg.depot_count_[index] < s_depot_max_batches)
+            {
+                reg.depot_[index][reg.depot_count_[index]++] = batch;
+                return;
+            }
+        }
+
+        cache.counters_.releases += s_batch_blocks;
+        while (batch)
+        {
+            free_block* block = batch;
+            batch = block->next_;
+            ::operator delete(block);
+        }
+    }
+
+    static std::size_t size_class(std::size_t size)
+    {
+        std::size_t index = 0;
+        std::size_t block = std::size_t(1) << s_min_shift;
+        while (block < size && index < s_class_count)
+        {
+            block <<= 1;
+            index++;
+        }
+        return index;
+    }
+
+    static std::size_t class_size(std::size_t index)
+    {
+        return std::size_t(1) << (index + s_min_shift);
+    }
+
+    static std::size_t class_limit(std::size_t index)
+    {
+        std::size_t limit = s_cache_bytes / class_size(index);
+        limit = limit < s_cache_max_blocks ? limit : s_cache_max_blocks;
+        return limit > s_batch_blocks ? limit : s_batch_blocks;
+    }
+
+    static void add(slab_stats& to, const slab_stats& from)
+    {
+        to.hits += from.hits;
+        to.misses += from.misses;
+        to.oversize += from.oversize;
+        to.releases += from.releases;
+    }
+
+    static registry& get_registry()
+    {
+        // never destroyed, thread caches may outlive static destruction
+        static registry* reg = new registry;
+        return *reg;
+    }
+
+    static thread_cache& local_cache()
+    {
+        static thread_local thread_cache cache;
+        return cache;
+    }
+};
+
+/// STL compatible allocator on top of slab_allocator, for objects with per worker life cycle
+/// (connections, request/response implementations, stream blocks) created through allocate_shared or kept in containers.
+/// Memory freed on a worker is reused by the next allocation of the same size class on that worker.
+template<typename T>
+class pool_allocator
+{
+public:
+    typedef T value_type;
+    typedef T* pointer;
+    typedef const T* const_pointer;
+    typedef T& reference;
+    typedef const T& const_reference;
+    typedef std::size_t size_type;
+    typedef std::ptrdiff_t difference_type;
+
+    template<typename U>
+    struct rebind
+    {
+        typedef pool_allocator<U> other;
+    };
+
+    pool_allocator()
+    {}
+
+    template<typename U>
+    pool_allocator(const pool_allocator<U>&)
+    {}
+
+    T* allocate(std::size_t n, const void* /*hint*/ = nullptr)
+    {
+        return static_cast<T*>(slab_allocator::allocate(n * sizeof(T)));
+    }
+
+    void deallocate(T* pointer, std::size_t n)
+    {
+        slab_allocator::deallocate(pointer, n * sizeof(T));
+    }
+
+    template<typename U, typename... Args>
+    void construct(U* pointer, Args&&... args)
+    {
+        ::new(static_cast<void*>(pointer)) U(std::forward<Args>(args)...);
+    }
+
+    template<typename U>
+    void destroy(U* pointer)
+    {
+        pointer->~U();
+    }
+
+    std::size_t max_size() const
+    {
+        return std::size_t(-1) / sizeof(T);
+    }
+};
+
+template<typename T, typename U>
+inline bool operator==(const pool_allocator<T>&, const pool_allocator<U>&)
+{
+    return true;
+}
+
+template<typename T, typename U>
+inline bool operator!=(const pool_allocator<T>&, const pool_allocator<U>&)
+{
+    return false;
+}
+
+/// Wraps handlers posted to an io_service so the asio operation holding them is allocated from the slab_allocator.
+template<typename Handler>
+class slab_handler
+{
+public:
+    slab_handler(Handler h) : handler_(h)
+    {}
+
+    void operator()()
+    {
+        handler_();
+    }
+
+    friend void* asio_handler_allocate(std::size_t size, slab_handler<Handler>* /*this_handler*/)
+    {
+        return slab_allocator::allocate(size);
+    }
+
+    friend void asio_handler_deallocate(void* pointer, std::size_t size, slab_handler<Handler>* /*this_handler*/)
+    {
+        slab_allocator::deallocate(pointer, size);
+    }
+
+private:
+    Handler handler_;
+};
+
+}
+#endif /* SLAB_ALLOCATOR_H_ */
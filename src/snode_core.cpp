@@ -12,6 +12,12 @@ using namespace boost::asio::ip;
 
 namespace snode
 {
+// service options
+static const char* s_reuse_port_option = "reusePort";
+
+#ifdef SO_REUSEPORT
+typedef boost::asio::detail::socket_option::boolean<SOL_SOCKET, SO_REUSEPORT> reuse_port_option;
+#endif
 
 void snode_core::run()
 {
@@ -19,7 +25,8 @@ void snode_core::run()
         throw std::runtime_error("Must call init() first");
     try
     {
-        // main process thread is the only one doing I/O
+        // main process thread is the only one doing I/O,
+        // in multi-reactor mode it only accepts new connections.
         if (THIS_THREAD_ID() == main_thread_)
             ios.run();
     }
@@ -38,14 +45,24 @@ void snode_core::stop()
         return;
     }
 
-    threadpool_->stop();
-    for (auto acceptor_it : acceptors_)
+    work_.reset();
+
+    // acceptors and connections bound to a worker io_service must be closed before the workers destroy it,
+    // the close is run by the worker itself ahead of its cancellation.
+    for (auto acceptor : acceptors_)
     {
-        boost::system::error_code err;
-        acceptor_it->cancel(err);
+        if (&acceptor->get_io_service() == &ios)
+            close_acceptor(acceptor);
+        else
+            acceptor->get_io_service().post(boost::bind(&snode_core::close_acceptor, acceptor));
     }
     acceptors_.clear();
 
+    for (auto service : services_)
+        service.second->stop();
+
+    threadpool_->stop();
+
     ios.stop();
     ios.reset();
 }
@@ -64,7 +81,15 @@ void snode_core::init(const std::string& filepath)
     if (config_.error())
         return;
 
-    threadpool_ = new threadpool(config_.threads());
+    worker_placement_list placement;
+    if (!make_worker_placement(config_.affinity(), config_.numa_node(), placement))
+    {
+        throw std::runtime_error("invalid worker affinity or NUMA node configuration");
+    }
+
+    threadpool_ = new threadpool(config_.threads(), config_.multi_reactor(), placement);
+    // sharded acceptors leave nothing to do on the main io_service, run() must block until stop() all the same
+    work_.reset(new boost::asio::io_service::work(ios));
     for (auto it = config_.services().begin(); it != config_.services().end(); it++)
     {
         net_service_base* service = service_factory::create_instance(it->name);
@@ -73,31 +98,59 @@ void snode_core::init(const std::string& filepath)
             continue;
         }
 
-        tcp_acceptor_ptr acceptor(new boost::asio::ip::tcp::acceptor(ios));
-        acceptor->open(boost::asio::ip::tcp::v4());
+        // create a network service object for every listening port
+        services_[it->listen_port] = service;
 
-        if (!it->host.empty())
+#ifdef SO_REUSEPORT
+        auto reuse_port = it->options.find(s_reuse_port_option);
+        if (reuse_port != it->options.end() && reuse_port->second == "1")
         {
-            boost::asio::ip::address ip_address;
-            ip_address.from_string(it->host);
-            acceptor->bind(tcp::endpoint(ip_address, it->listen_port));
-        }
-        else
-        {
-            acceptor->bind(tcp::endpoint(tcp::v4(), it->listen_port));
+            // one listening socket per worker thread, the kernel spreads incoming connections between them.
+            // With a single I/O loop all of them would be accepted on the same thread, nothing to spread.
+            if (threadpool_->multi_reactor())
+            {
+                for (auto thread : threadpool_->threads())
+                    start_accept(open_acceptor(threadpool_->get_io_service(thread->get_id()), *it, true));
+                continue;
+            }
+            std::cerr << it->name << ": " << s_reuse_port_option << " needs multireactor, using one listening socket" << std::endl;
         }
+#endif
+        start_accept(open_acceptor(ios, *it, false));
+    }
+}
 
-        acceptor->set_option(tcp::acceptor::reuse_address(true));
-        acceptor->listen();
-        acceptors_.push_back(acceptor);
+tcp_acceptor_ptr snode_core::open_acceptor(boost::asio::io_service& io, const net_service_config& config, bool reuse_port)
+{
+    tcp_acceptor_ptr acceptor(new boost::asio::ip::tcp::acceptor(io));
+    acceptor->open(boost::asio::ip::tcp::v4());
 
-        // accept code follows
-        tcp_socket_ptr socket(new tcp::socket(acceptor->get_io_service()));
-        acceptor->async_accept(*socket, boost::bind(&snode_core::handle_accept, this, socket, acceptor, boost::asio::placeholders::error));
+    // socket options must be set before bind() to take effect
+    acceptor->set_option(tcp::acceptor::reuse_address(true));
+#ifdef SO_REUSEPORT
+    if (reuse_port)
+        acceptor->set_option(reuse_port_option(true));
+#endif
 
-        // create a network service object for every listening port
-        services_[it->listen_port] = service;
+    if (!config.host.empty())
+    {
+        boost::asio::ip::address ip_address = boost::asio::ip::address::from_string(config.host);
+        acceptor->bind(tcp::endpoint(ip_address, config.listen_port));
     }
+    else
+    {
+        acceptor->bind(tcp::endpoint(tcp::v4(), config.listen_port));
+    }
+
+    acceptor->listen();
+    acceptors_.push_back(acceptor);
+    return acceptor;
+}
+
+void snode_core::start_accept(tcp_acceptor_ptr acceptor)
+{
+    tcp_socket_ptr socket(new tcp::socket(accept_io_service(acceptor)));
+    acceptor->async_accept(*socket, boost::bind(&snode_core::handle_accept, this, socket, acceptor, boost::asio::placeholders::error));
 }
 
 void snode_core::handle_accept(tcp_socket_ptr sock, tcp_acceptor_ptr acceptor, const boost::system::error_code& err)
@@ -106,13 +159,13 @@ void snode_core::handle_accept(tcp_socket_ptr sock, tcp_acceptor_ptr acceptor, c
     {
         try
         {
-            // service is responsible to dispatch this to a worker thread
-            net_service_base* service = services_[acceptor->local_endpoint().port()];
+            // service is responsible to dispatch this to a worker thread,
+            // sharded acceptors complete on their own worker so the services map is only read here.
+            net_service_base* service = services_.find(acceptor->local_endpoint().port())->second;
             service->accept(sock);
 
             // continue accepting new connections
-            tcp_socket_ptr newsock(new tcp::socket(acceptor->get_io_service()));
-            acceptor->async_accept(*newsock, boost::bind(&snode_core::handle_accept, this, newsock, acceptor, boost::asio::placeholders::error));
+            start_accept(acceptor);
         }
         catch (std::exception& ex)
         {
@@ -121,12 +174,32 @@ void snode_core::handle_accept(tcp_socket_ptr sock, tcp_acceptor_ptr acceptor, c
     }
 }
 
+void snode_core::close_acceptor(tcp_acceptor_ptr acceptor)
+{
+    boost::system::error_code err;
+    acceptor->cancel(err);
+    acceptor->close(err);
+}
+
+boost::asio::io_service& snode_core::accept_io_service(tcp_acceptor_ptr acceptor)
+{
+    // in multi-reactor mode accept directly into a worker's io_service,
+    // so the connection never has to hop threads on socket events.
+    // Sharded acceptors already run on a worker and keep their connections there.
+    if (threadpool_->multi_reactor() && &acceptor->get_io_service() == &ios)
+        return threadpool_->next_io_service();
+    else
+        return acceptor->get_io_service();
+}
+
 snode_core::snode_core()
 : threadpool_(nullptr), main_thread_(THIS_THREAD_ID())
 {}
 
 snode_core::~snode_core()
 {
+    // sharded acceptors must not outlive the worker io_services
+    acceptors_.clear();
     delete threadpool_;
 }
 
@@ -27,11 +27,12 @@ class snode_core
 {
 private:
     boost::asio::io_service                      ios;                 /// boost io_service object to perform all socket based I/O.
+    std::unique_ptr<boost::asio::io_service::work> work_;             /// keeps run() blocking while the main io_service has no acceptors (sharded mode).
     snode::threadpool*                           threadpool_;         /// handling all I/O and event messaging tasks.
     std::list<tcp_acceptor_ptr>                  acceptors_;          /// socket acceptors listening for incoming connections.
     snode_config                                 config_;             /// global configuration.
     std::map<unsigned short, net_service_base*>  services_;           /// network port -> net_service object map association.
-    thread_id_t                                  main_thread_;        /// main thread of execution (dedicated to the I/O service loop)
+    thread_id_t                                  main_thread_;        /// main thread of execution (dedicated to the I/O service loop or only accepting in multi-reactor mode)
 
 public:
     /// server_controller is a singleton, can be accessed only with this method.
@@ -64,6 +65,19 @@ private:
     /// boost acceptor handler callback function
     void handle_accept(tcp_socket_ptr sock, tcp_acceptor_ptr acceptor, const boost::system::error_code& err);
 
+    /// Open a listening socket for a service configuration on the given io_service (io).
+    /// With (reuse_port) set, SO_REUSEPORT is enabled so several acceptors can share the same port.
+    tcp_acceptor_ptr open_acceptor(boost::asio::io_service& io, const net_service_config& config, bool reuse_port);
+
+    /// Start an asynchronous accept operation for the next connection on (acceptor).
+    void start_accept(tcp_acceptor_ptr acceptor);
+
+    /// Cancel pending accepts and close the listening socket, must run on the thread of the acceptor's io_service.
+    static void close_acceptor(tcp_acceptor_ptr acceptor);
+
+    /// Get the io_service for the next socket to be accepted with (acceptor).
+    boost::asio::io_service& accept_io_service(tcp_acceptor_ptr acceptor);
+
     snode_core();
     ~snode_core();
 };
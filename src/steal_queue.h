@@ -0,0 +1,71 @@
+//
+// steal_queue.h
+// Copyright (C) 2015  Emil Penchev, Bulgaria
+//
+
+#ifndef STEAL_QUEUE_H_
+#define STEAL_QUEUE_H_
+
+#include <deque>
+#include <boost/thread/locks.hpp>
+#include <boost/thread/mutex.hpp>
+
+namespace snode
+{
+/// Work stealing deque of task pointers.
+/// The owner pushes and pops at the back (LIFO, cache warm), other threads steal from the front (FIFO, oldest first).
+template <typename T>
+class steal_queue
+{
+public:
+    steal_queue()
+    {}
+
+    /// Insert element at the back.
+    void push(T* entry)
+    {
+        boost::lock_guard<boost::mutex> lock_guard(mutex_lock_);
+        queue_impl_.push_back(entry);
+    }
+
+    /// Get/remove the newest element, returns nullptr if the queue is empty. Used by the owner.
+    T* pop()
+    {
+        boost::lock_guard<boost::mutex> lock_guard(mutex_lock_);
+        if (queue_impl_.empty())
+            return nullptr;
+
+        T* entry = queue_impl_.back();
+        queue_impl_.pop_back();
+        return entry;
+    }
+
+    /// Get/remove the oldest element, returns nullptr if the queue is empty. Used by thieves.
+    T* steal()
+    {
+        boost::lock_guard<boost::mutex> lock_guard(mutex_lock_);
+        if (queue_impl_.empty())
+            return nullptr;
+
+        T* entry = queue_impl_.front();
+        queue_impl_.pop_front();
+        return entry;
+    }
+
+    /// Check if the queue has no elements, the answer may be stale by the time it is used.
+    bool empty()
+    {
+        boost::lock_guard<boost::mutex> lock_guard(mutex_lock_);
+        return queue_impl_.empty();
+    }
+
+private:
+    steal_queue(const steal_queue&) = delete;
+    steal_queue& operator=(const steal_queue&) = delete;
+
+    std::deque<T*> queue_impl_;
+    boost::mutex mutex_lock_;
+};
+
+}
+#endif /* STEAL_QUEUE_H_ */
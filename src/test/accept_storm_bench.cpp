@@ -0,0 +1,128 @@
+//
+// accept_storm_bench.cpp
+// Connection storm benchmark, accept rate against accepting thread count
+// for one shared listening socket and for SO_REUSEPORT sharded listening sockets (one per thread).
+//
+// compile
+// g++ -std=c++11 -O2 -Wall accept_storm_bench.cpp -o accept_storm_bench -lpthread -lboost_system
+//
+// run
+// ./accept_storm_bench [seconds per run] [client threads]
+
+#include <boost/asio.hpp>
+#include <poll.h>
+
+#include <atomic>
+#include <chrono>
+#include <cstdlib>
+#include <iostream>
+#include <memory>
+#include <thread>
+#include <vector>
+
+using namespace boost::asio;
+using namespace boost::asio::ip;
+
+typedef boost::asio::detail::socket_option::boolean<SOL_SOCKET, SO_REUSEPORT> reuse_port;
+typedef std::shared_ptr<tcp::acceptor> acceptor_ptr;
+
+static std::atomic<bool> s_running;
+static std::atomic<unsigned long> s_accepted;
+
+acceptor_ptr open_acceptor(io_service& ios, unsigned short port, bool sharded)
+{
+    acceptor_ptr acceptor = std::make_shared<tcp::acceptor>(ios);
+    acceptor->open(tcp::v4());
+    acceptor->set_option(tcp::acceptor::reuse_address(true));
+    if (sharded)
+        acceptor->set_option(reuse_port(true));
+    acceptor->bind(tcp::endpoint(address_v4::loopback(), port));
+    acceptor->listen(socket_base::max_connections);
+    acceptor->non_blocking(true);
+    return acceptor;
+}
+
+void accept_loop(acceptor_ptr acceptor)
+{
+    io_service ios;
+    while (s_running)
+    {
+        tcp::socket sock(ios);
+        boost::system::error_code err;
+        acceptor->accept(sock, err);
+        if (!err)
+        {
+            s_accepted++;
+            sock.close(err);
+        }
+        else if (err == error::would_block || err == error::try_again)
+        {
+            pollfd pfd = { acceptor->native_handle(), POLLIN, 0 };
+            ::poll(&pfd, 1, 10);
+        }
+    }
+}
+
+void connect_loop(unsigned short port)
+{
+    io_service ios;
+    tcp::endpoint endpoint(address_v4::loopback(), port);
+    while (s_running)
+    {
+        tcp::socket sock(ios);
+        boost::system::error_code err;
+        sock.connect(endpoint, err);
+        // reset on close, avoids running out of ephemeral ports with sockets in TIME_WAIT
+        sock.set_option(socket_base::linger(true, 0), err);
+        sock.close(err);
+    }
+}
+
+double run(unsigned threads, bool sharded, unsigned clients, unsigned seconds)
+{
+    io_service ios;
+    std::vector<acceptor_ptr> acceptors;
+    acceptors.push_back(open_acceptor(ios, 0, sharded));
+    unsigned short port = acceptors.front()->local_endpoint().port();
+
+    for (unsigned i = 1; sharded && i < threads; i++)
+        acceptors.push_back(open_acceptor(ios, port, sharded));
+
+    s_running = true;
+    s_accepted = 0;
+
+    std::vector<std::thread> workers;
+    for (unsigned i = 0; i < threads; i++)
+        workers.push_back(std::thread(accept_loop, acceptors[i % acceptors.size()]));
+    for (unsigned i = 0; i < clients; i++)
+        workers.push_back(std::thread(connect_loop, port));
+
+    auto start = std::chrono::steady_clock::now();
+    std::this_thread::sleep_for(std::chrono::seconds(seconds));
+    unsigned long accepted = s_accepted;
+    std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+
+    s_running = false;
+    for (auto& worker : workers)
+        worker.join();
+
+    return accepted / elapsed.count();
+}
+
+int main(int argc, char* argv[])
+{
+    unsigned seconds = argc > 1 ? std::atoi(argv[1]) : 2;
+    unsigned clients = argc > 2 ? std::atoi(argv[2]) : 8;
+    unsigned thread_counts[] = { 1, 2, 4, 8 };
+
+    std::cout << "clients: " << clients << ", " << seconds << "s per run" << std::endl;
+    std::cout << "threads\tshared acceptor (conn/s)\treuseport acceptors (conn/s)" << std::endl;
+    for (auto threads : thread_counts)
+    {
+        double shared = run(threads, false, clients, seconds);
+        double sharded = run(threads, true, clients, seconds);
+        std::cout << threads << "\t" << static_cast<unsigned long>(shared)
+                  << "\t\t\t\t" << static_cast<unsigned long>(sharded) << std::endl;
+    }
+    return 0;
+}
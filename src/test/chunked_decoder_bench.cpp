@@ -0,0 +1,270 @@
+//
+// chunked_decoder_bench.cpp
+// Chunked request body decoding, the way http_connection did it (find the size line, istream >> std::hex, wait until
+// the whole chunk and its CRLF are buffered, then copy it out) against chunked_decoder streaming the chunk data as
+// it arrives. The body is fed in socket sized reads, with small chunks and with one huge chunk.
+// Reports the throughput and the most bytes each had to keep buffered. Also checks the decoder on random bodies
+// with extensions and trailers split at random points.
+//
+// compile
+// g++ -std=c++11 -O2 -Wall chunked_decoder_bench.cpp ../chunked_decoder.cpp -o chunked_decoder_bench -lboost_system
+//
+// run
+// ./chunked_decoder_bench [huge chunk MB]
+
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <locale>
+#include <random>
+#include <string>
+#include <vector>
+#include <boost/asio.hpp>
+
+#include "../chunked_decoder.h"
+
+using namespace snode::http;
+
+static const size_t s_read_size = 16 * 1024;
+
+std::string make_body(size_t chunk_size, size_t total, std::string& payload)
+{
+    std::string body;
+    char line[32];
+    for (size_t sent = 0; sent < total; sent += chunk_size)
+    {
+        size_t size = std::min(chunk_size, total - sent);
+        snprintf(line, sizeof(line), "%zx\r\n", size);
+        body += line;
+        size_t start = payload.size();
+        for (size_t i = 0; i < size; i++)
+            payload.push_back(static_cast<char>('a' + (start + i) % 26));
+        body.append(payload, start, size);
+        body += "\r\n";
+    }
+    return body + "0\r\n\r\n";
+}
+
+// body copied out of the receive buffer, a stand in for the request's body stream buffer
+struct sink
+{
+    sink() : size_(0), copy_(nullptr) {}
+
+    void write(const char* data, size_t size)
+    {
+        size_t pos = 0;
+        while (pos < size)
+        {
+            size_t n = std::min(size - pos, sizeof(block_));
+            memcpy(block_, data + pos, n);
+            pos += n;
+        }
+        size_ += size;
+        if (copy_)
+            copy_->append(data, size);
+    }
+
+    char block_[s_read_size];
+    size_t size_;
+    std::string* copy_;     // the body is kept for the checks
+};
+
+// handle_chunked_header / handle_chunked_body
+bool legacy_decode(const std::string& body, sink& out, size_t& peak)
+{
+    boost::asio::streambuf buf;
+    size_t fed = 0;
+    peak = 0;
+    auto feed = [&]() -> bool
+    {
+        if (fed == body.size())
+            return false;
+        size_t n = std::min(s_read_size, body.size() - fed);
+        auto space = buf.prepare(n);
+        memcpy(boost::asio::buffer_cast<char*>(space), body.data() + fed, n);
+        buf.commit(n);
+        fed += n;
+        peak = std::max(peak, buf.size());
+        return true;
+    };
+
+    for (;;)
+    {
+        // async_read_until(CRLF)
+        for (;;)
+        {
+            const char* data = boost::asio::buffer_cast<const char*>(buf.data());
+            if (buf.size() >= 2 && memmem(data, buf.size(), "\r\n", 2))
+                break;
+            if (!feed())
+                return false;
+        }
+
+        std::istream is(&buf);
+        is.imbue(std::locale::classic());
+        int len;
+        is >> std::hex >> len;
+        buf.consume(2);
+        if (len == 0)
+            return true;
+
+        // async_read_until_buffersize(len + 2)
+        while (buf.size() < static_cast<size_t>(len) + 2)
+        {
+            if (!feed())
+                return false;
+        }
+        out.write(boost::asio::buffer_cast<const char*>(buf.data()), len);
+        buf.consume(len + 2);
+    }
+}
+
+// http_connection::read_chunked_body(), the chunk data goes straight to the sink
+bool decoder_decode(const std::string& body, sink& out, size_t& peak, const std::vector<size_t>* splits = nullptr)
+{
+    chunked_decoder decoder;
+    std::string buf;
+    size_t fed = 0, split = 0;
+    peak = 0;
+    for (;;)
+    {
+        size_t consumed = 0;
+        chunked_decoder::result result = decoder.parse(buf.data(), buf.size(), consumed);
+        buf.erase(0, consumed);
+        if (chunked_decoder::done == result)
+            return buf.empty();
+        if (chunked_decoder::error == result)
+            return false;
+
+        if (chunked_decoder::payload == result && !buf.empty())
+        {
+            size_t n = static_cast<size_t>(std::min<uint64_t>(decoder.payload_left(), buf.size()));
+            out.write(buf.data(), n);
+            buf.erase(0, n);
+            decoder.consume_payload(n);
+            continue;
+        }
+
+        if (fed == body.size())
+            return false;
+
+        size_t n = splits ? (*splits)[split++ % splits->size()] : s_read_size;
+        n = std::min(n, body.size() - fed);
+        if (chunked_decoder::payload == result)
+        {
+            // read from the socket into the body stream buffer
+            n = static_cast<size_t>(std::min<uint64_t>(n, decoder.payload_left()));
+            out.write(body.data() + fed, n);
+            decoder.consume_payload(n);
+        }
+        else
+        {
+            buf.append(body, fed, n);
+            peak = std::max(peak, buf.size());
+        }
+        fed += n;
+    }
+}
+
+bool check_random(size_t rounds)
+{
+    std::mt19937 rng(2015);
+    for (size_t round = 0; round < rounds; round++)
+    {
+        std::string body, payload;
+        size_t chunks = rng() % 6;
+        for (size_t c = 0; c < chunks; c++)
+        {
+            size_t size = 1 + rng() % 300;
+            char line[64];
+            snprintf(line, sizeof(line), rng() % 2 ? "%zX" : "%zx", size);
+            body += line;
+            if (rng() % 3 == 0)
+                body += ";name=value;q=\"x\"";
+            body += "\r\n";
+            for (size_t i = 0; i < size; i++)
+                payload.push_back(static_cast<char>(rng() % 256));
+            body.append(payload, payload.size() - size, size);
+            body += "\r\n";
+        }
+        body += "0\r\n";
+        if (rng() % 2)
+            body += "Expires: never\r\nX-Checksum: 1234\r\n";
+        body += "\r\n";
+
+        std::vector<size_t> splits;
+        for (size_t i = 0; i < 16; i++)
+            splits.push_back(1 + rng() % 40);
+
+        std::string result;
+        sink decoded;
+        decoded.copy_ = &result;
+        size_t peak;
+        if (!decoder_decode(body, decoded, peak, &splits) || result != payload)
+        {
+            std::cout << "decoder mismatch at round " << round << std::endl;
+            return false;
+        }
+    }
+
+    // malformed bodies
+    const char* bad[] = { "x\r\n", "5\r\nabcdeXY", "\r\n", "5;\n", "11111111111111111\r\n", "0\r\nbad\n" };
+    for (const char* body : bad)
+    {
+        sink out;
+        size_t peak;
+        if (decoder_decode(body, out, peak))
+        {
+            std::cout << "accepted malformed body " << body << std::endl;
+            return false;
+        }
+    }
+    return true;
+}
+
+template<typename Decode>
+double run(Decode decode, const std::string& body, size_t expected, size_t& peak)
+{
+    sink out;
+    auto start = std::chrono::steady_clock::now();
+    bool ok = decode(body, out, peak);
+    std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+    if (!ok || out.size_ != expected)
+        std::cout << "decoding failed" << std::endl;
+    return expected / elapsed.count() / (1024 * 1024);
+}
+
+int main(int argc, char* argv[])
+{
+    size_t huge_mb = argc > 1 ? std::strtoul(argv[1], nullptr, 10) : 100;
+
+    if (!check_random(100000))
+        return 1;
+
+    struct scenario
+    {
+        const char* name;
+        size_t chunk_size;
+        size_t total;
+    } scenarios[] =
+    {
+        { "64 byte chunks", 64, 16 * 1024 * 1024 },
+        { "4K chunks", 4096, 64 * 1024 * 1024 },
+        { "one huge chunk", huge_mb * 1024 * 1024, huge_mb * 1024 * 1024 }
+    };
+
+    for (const auto& s : scenarios)
+    {
+        std::string payload;
+        std::string body = make_body(s.chunk_size, s.total, payload);
+        size_t legacy_peak = 0, decoder_peak = 0;
+        auto legacy = [](const std::string& b, sink& out, size_t& peak) { return legacy_decode(b, out, peak); };
+        auto decoder = [](const std::string& b, sink& out, size_t& peak) { return decoder_decode(b, out, peak); };
+        double legacy_mbs = run(legacy, body, payload.size(), legacy_peak);
+        double decoder_mbs = run(decoder, body, payload.size(), decoder_peak);
+        std::cout << s.name << ": istream " << legacy_mbs << " MB/s, buffered up to " << legacy_peak << " bytes; decoder "
+                  << decoder_mbs << " MB/s, buffered up to " << decoder_peak << " bytes" << std::endl;
+    }
+    return 0;
+}
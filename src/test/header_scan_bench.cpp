@@ -0,0 +1,180 @@
+//
+// header_scan_bench.cpp
+// Request header terminator search, the byte at a time crlf_nonascii_searcher against the SIMD header scanner.
+// Both run as async_read_until() match conditions over a streambuf holding a request with 200 bytes to 8K of headers.
+// Also checks that the scalar and the SIMD scanners agree with the old searcher on random input.
+//
+// compile
+// g++ -std=c++11 -O2 -Wall header_scan_bench.cpp ../header_scanner.cpp -o header_scan_bench -lboost_system
+//
+// run
+// ./header_scan_bench [iterations]
+
+#include <chrono>
+#include <cstdlib>
+#include <iostream>
+#include <random>
+#include <string>
+#include <utility>
+#include <boost/asio.hpp>
+
+#include "../header_scanner.h"
+
+using namespace snode::http;
+
+// the searcher as it was before the SIMD scanner
+struct legacy_searcher
+{
+    enum class State { none, cr, crlf, crlfcr };
+
+    template<typename Iter>
+    std::pair<Iter, bool> operator()(const Iter begin, const Iter end) const
+    {
+        Iter excluded = begin;
+        Iter cur = begin;
+        State state = State::none;
+        while (cur != end)
+        {
+            char c = *cur;
+            if (c == '\r')
+            {
+                if (state == State::crlf)
+                {
+                    state = State::crlfcr;
+                }
+                else
+                {
+                    excluded = cur;
+                    state = State::cr;
+                }
+            }
+            else if (c == '\n')
+            {
+                if (state == State::cr)
+                    state = State::crlf;
+                else if (state == State::crlfcr)
+                    return std::make_pair(++cur, true);
+                else
+                    state = State::none;
+            }
+            else if (c <= '\x1F' && c >= '\x00')
+            {
+                return std::make_pair(++cur, true);
+            }
+            else if (c <= '\xFF' && c >= '\x80')
+            {
+                return std::make_pair(++cur, true);
+            }
+            else
+            {
+                state = State::none;
+            }
+            ++cur;
+            if (state == State::none)
+                excluded = cur;
+        }
+        return std::make_pair(excluded, false);
+    }
+};
+
+struct simd_searcher
+{
+    template<typename Iter>
+    std::pair<Iter, bool> operator()(const Iter begin, const Iter end) const
+    {
+        if (begin == end)
+            return std::make_pair(begin, false);
+        header_scan result = scan_header_end(&*begin, static_cast<size_t>(end - begin));
+        return std::make_pair(begin + result.end_, result.found_);
+    }
+};
+
+std::string make_request(size_t header_size)
+{
+    static const char* lines[] =
+    {
+        "Host: www.example.com\r\n",
+        "User-Agent: Mozilla/5.0 (X11; Linux x86_64; rv:38.0) Gecko/20100101 Firefox/38.0\r\n",
+        "Accept: text/html,application/xhtml+xml,application/xml;q=0.9,*/*;q=0.8\r\n",
+        "Accept-Language: en-US,en;q=0.5\r\n",
+        "Accept-Encoding: gzip, deflate\r\n",
+        "Cookie: session=8f3a2c9d7e6b5a4f3e2d1c0b9a8f7e6d; theme=dark; lang=en; tracking=0123456789abcdef\r\n",
+        "Connection: keep-alive\r\n",
+        "Cache-Control: max-age=0\r\n"
+    };
+
+    std::string request = "GET /index.html?query=value HTTP/1.1\r\n";
+    for (size_t i = 0; request.size() < header_size; i++)
+        request += lines[i % (sizeof(lines) / sizeof(lines[0]))];
+    return request + "\r\n";
+}
+
+bool check_random(size_t rounds)
+{
+    std::mt19937 rng(12345);
+    const char alphabet[] = { '\r', '\n', '\r', '\n', 'a', ' ', ':', '\t', '\x7f', '\x80', '\xff', '\x01' };
+    for (size_t round = 0; round < rounds; round++)
+    {
+        std::string data(rng() % 200, 'x');
+        for (auto& ch : data)
+        {
+            unsigned r = rng() % 64;
+            if (r < sizeof(alphabet))
+                ch = alphabet[r];
+        }
+
+        std::pair<const char*, bool> expected = legacy_searcher()(data.data(), data.data() + data.size());
+        header_scan scalar = scan_header_end_scalar(data.data(), data.size());
+        header_scan simd = scan_header_end(data.data(), data.size());
+        size_t offset = static_cast<size_t>(expected.first - data.data());
+        if (scalar.end_ != offset || scalar.found_ != expected.second || simd.end_ != offset || simd.found_ != expected.second)
+        {
+            std::cout << "mismatch at round " << round << " size " << data.size() << " expected " << offset
+                      << " scalar " << scalar.end_ << " simd " << simd.end_ << std::endl;
+            return false;
+        }
+    }
+    return true;
+}
+
+template<typename Searcher>
+double run(const std::string& request, size_t iterations)
+{
+    boost::asio::streambuf buf;
+    std::ostream(&buf) << request;
+    typedef boost::asio::buffers_iterator<boost::asio::streambuf::const_buffers_type> iterator;
+
+    size_t found = 0;
+    auto start = std::chrono::steady_clock::now();
+    for (size_t i = 0; i < iterations; i++)
+    {
+        iterator begin = iterator::begin(buf.data());
+        iterator end = iterator::end(buf.data());
+        std::pair<iterator, bool> result = Searcher()(begin, end);
+        found += static_cast<size_t>(result.first - begin);
+    }
+    std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+    if (found != iterations * request.size())
+        std::cout << "terminator not found" << std::endl;
+    return elapsed.count() * 1e9 / iterations;
+}
+
+int main(int argc, char* argv[])
+{
+    size_t iterations = argc > 1 ? std::strtoul(argv[1], nullptr, 10) : 200000;
+
+    if (!check_random(200000))
+        return 1;
+
+    std::cout << "scanner: " << header_scanner_name() << std::endl;
+    const size_t sizes[] = { 200, 512, 1024, 2048, 4096, 8192 };
+    for (size_t size : sizes)
+    {
+        std::string request = make_request(size);
+        double legacy = run<legacy_searcher>(request, iterations);
+        double simd = run<simd_searcher>(request, iterations);
+        std::cout << request.size() << " bytes: searcher " << legacy << " ns, simd " << simd << " ns ("
+                  << legacy / simd << "x)" << std::endl;
+    }
+    return 0;
+}
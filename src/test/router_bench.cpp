@@ -0,0 +1,132 @@
+//
+// router_bench.cpp
+// Request handler lookup benchmark, the old prefix search (split the path with an istringstream, build every
+// prefix string and look it up in a std::map) against path_router's longest prefix match on the raw URL.
+// Routes are registered the way http_service does it, thousands of them, requests hit deep and missing paths.
+//
+// compile
+// g++ -std=c++11 -O2 -Wall router_bench.cpp ../uri_utils.cpp -o router_bench
+//
+// run
+// ./router_bench [routes] [lookups]
+
+#include <chrono>
+#include <cstdlib>
+#include <iostream>
+#include <locale>
+#include <map>
+#include <random>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "../path_router.h"
+
+using namespace snode;
+
+// the lookup as http_connection::dispatch_request_to_listener() did it
+struct map_router
+{
+    std::map<std::string, int> handlers_;
+
+    static std::vector<std::string> split_path(const std::string& path)
+    {
+        std::vector<std::string> results;
+        std::istringstream iss(path);
+        iss.imbue(std::locale::classic());
+        std::string str;
+        while (std::getline(iss, str, '/'))
+        {
+            if (!str.empty())
+                results.push_back(str);
+        }
+        return results;
+    }
+
+    const int* match(const std::string& url) const
+    {
+        auto path_segments = split_path(path_router<int>::url_path(url).to_string());
+        for (auto i = static_cast<long>(path_segments.size()); i >= 0; --i)
+        {
+            std::string path = "";
+            for (size_t j = 0; j < static_cast<size_t>(i); ++j)
+            {
+                path += "/" + path_segments[j];
+            }
+            path += "/";
+
+            auto it = handlers_.find(path);
+            if (it != handlers_.end())
+                return &it->second;
+        }
+        return nullptr;
+    }
+};
+
+template<typename Router>
+double run(const Router& router, const std::vector<std::string>& urls, size_t lookups, long& checksum)
+{
+    auto start = std::chrono::steady_clock::now();
+    for (size_t i = 0; i < lookups; i++)
+    {
+        const int* value = router.match(urls[i % urls.size()]);
+        checksum += value ? *value : -1;
+    }
+    std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+    return elapsed.count() * 1e9 / lookups;
+}
+
+int main(int argc, char* argv[])
+{
+    size_t routes = argc > 1 ? std::strtoul(argv[1], nullptr, 10) : 5000;
+    size_t lookups = argc > 2 ? std::strtoul(argv[2], nullptr, 10) : 1000000;
+
+    map_router old_router;
+    path_router<int> router;
+    router.add("/", 0);
+    old_router.handlers_["/"] = 0;
+
+    // /api/v<n>/<resource>/ and some deeper /api/v<n>/<resource>/<sub>/ handlers
+    for (size_t i = 1; i <= routes; i++)
+    {
+        std::string path = "/api/v" + std::to_string(i % 4) + "/resource" + std::to_string(i) + "/";
+        if (i % 3 == 0)
+            path += "items" + std::to_string(i % 7) + "/";
+        router.add(path, static_cast<int>(i));
+        old_router.handlers_[path] = static_cast<int>(i);
+    }
+    router.compile();
+
+    std::mt19937 rng(42);
+    std::vector<std::string> urls;
+    for (size_t i = 0; i < 4096; i++)
+    {
+        size_t n = rng() % (routes + routes / 10) + 1; // some misses fall back to "/"
+        std::string url = "/api/v" + std::to_string(n % 4) + "/resource" + std::to_string(n) + "/items" +
+                          std::to_string(n % 7) + "/entry/" + std::to_string(rng() % 1000) + "?format=json&page=2";
+        if (i % 8 == 0)
+            url = "http://www.example.com" + url;
+        urls.push_back(url);
+    }
+
+    // both must resolve the same handlers
+    for (const auto& url : urls)
+    {
+        const int* a = old_router.match(url);
+        const int* b = router.match(url);
+        if (!a || !b || *a != *b)
+        {
+            std::cout << "mismatch for " << url << std::endl;
+            return 1;
+        }
+    }
+
+    long checksum_old = 0, checksum_new = 0;
+    double old_ns = run(old_router, urls, lookups / 10, checksum_old);
+    double new_ns = run(router, urls, lookups, checksum_new);
+
+    std::cout << router.size() << " routes" << std::endl;
+    std::cout << "split + std::map: " << old_ns << " ns/lookup" << std::endl;
+    std::cout << "path_router:      " << new_ns << " ns/lookup (" << old_ns / new_ns << "x)" << std::endl;
+    return checksum_old && checksum_new ? 0 : 1;
+}
@@ -2,6 +2,7 @@
 #include <string>
 #include <functional>
 #include <algorithm>
+#include <cstring>
 #include <chrono>
 #include <thread>
 
@@ -18,7 +19,8 @@ using namespace boost::unit_test;
 
 /*
  * shell compile
- *  g++ -std=c++11 -g -Wall -I../ streambuf_test.cpp ../config_reader.o ../http_helpers.o ../http_msg.o ../http_service.o ../snode_core.o ../uri_utils.o
+ *  g++ -std=c++11 -g -Wall -I../ streambuf_test.cpp ../chunked_decoder.o ../config_reader.o ../cpu_affinity.o ../header_scanner.o
+   ../http_helpers.o ../http_msg.o ../http_parser.o ../http_service.o ../snode_core.o ../uri_utils.o
    -o streambuf_test -lpthread -lboost_system -lboost_thread
  *
  */
@@ -406,6 +408,42 @@ void test_streambuf_alloc_commit(StreamBufferTypePtr wbuf)
     finish_test();
 }
 
+template<typename StreamBufferTypePtr>
+void test_streambuf_alloc_reuse(StreamBufferTypePtr wbuf)
+{
+    typedef typename StreamBufferTypePtr::element_type::char_type ch_type;
+    typedef std::shared_ptr<std::vector<ch_type> > vector_ptr;
+
+    size_t allocSize = 10;
+    size_t commitSize = 2;
+    ch_type* last = nullptr;
+
+    for (size_t i = 0; i < allocSize/commitSize; i++)
+    {
+        // the space left in the write block is handed out again
+        auto data = wbuf->alloc(allocSize);
+        BOOST_ASSERT(data != nullptr);
+        if (last)
+            BOOST_CHECK_EQUAL(last + commitSize, data);
+        last = data;
+
+        for (size_t j = 0; j < commitSize; j++)
+            data[j] = (ch_type)(i * commitSize + j);
+        wbuf->commit(commitSize);
+    }
+    wbuf->close(std::ios_base::out);
+
+    vector_ptr ptr = std::make_shared<std::vector<ch_type> >(allocSize);
+    auto handler_read = [](size_t count, StreamBufferTypePtr rbuf, vector_ptr ptr)
+    {
+        BOOST_CHECK_EQUAL(count, ptr->size());
+        for (size_t i = 0; i < count; i++)
+            BOOST_CHECK_EQUAL((ch_type)i, ptr->at(i));
+        finish_test();
+    };
+    wbuf->getn(ptr->data(), ptr->size(), std::bind(handler_read, std::placeholders::_1, wbuf, ptr));
+}
+
 template<typename StreamBufferTypePtr>
 void test_streambuf_seek_write(StreamBufferTypePtr wbuf)
 {
@@ -492,6 +530,209 @@ void test_producer_consumer_alloc_commt()
     test_streambuf_alloc_commit(buf);
 }
 
+void test_producer_consumer_alloc_reuse()
+{
+    prod_cons_buf_ptr buf = std::make_shared<snode::streams::producer_consumer_buffer<char_type>>();
+    test_streambuf_alloc_reuse(buf);
+}
+
+// drained blocks go to the free list and are handed out again
+void test_producer_consumer_block_reuse()
+{
+    prod_cons_buf_ptr buf = std::make_shared<snode::streams::producer_consumer_buffer<char_type>>(512);
+    auto impl = buf->get_impl();
+    uint8_t target[512];
+
+    auto first = buf->alloc(512);
+    BOOST_ASSERT(first != nullptr);
+    buf->commit(512);
+    BOOST_CHECK_EQUAL(512, buf->sgetn(target, 512));
+    BOOST_CHECK_EQUAL(1, impl->free_blocks());
+
+    auto second = buf->alloc(512);
+    BOOST_CHECK_EQUAL(first, second);
+    BOOST_CHECK_EQUAL(0, impl->free_blocks());
+    buf->commit(512);
+
+    // drained with acquire()/release()
+    uint8_t* ptr = nullptr;
+    size_t count = 0;
+    BOOST_CHECK_EQUAL(true, buf->acquire(ptr, count));
+    BOOST_CHECK_EQUAL(512, count);
+    buf->release(ptr, count);
+    BOOST_CHECK_EQUAL(1, impl->free_blocks());
+
+    buf->close();
+    finish_test();
+}
+
+// data written between alloc() and commit() is read before the committed data
+void test_producer_consumer_alloc_order()
+{
+    static prod_cons_buf_ptr buf;
+    static const uint8_t written = 'c';
+
+    buf = std::make_shared<snode::streams::producer_consumer_buffer<char_type>>(512);
+    auto data = buf->alloc(2);
+    data[0] = 'a';
+    data[1] = 'b';
+    buf->commit(2);
+
+    // space left in the tail block
+    data = buf->alloc(1);
+    data[0] = 'd';
+
+    auto handler_write = [](size_t count)
+    {
+        BOOST_CHECK_EQUAL(1, count);
+        buf->commit(1);
+
+        uint8_t target[4];
+        BOOST_CHECK_EQUAL(4, buf->sgetn(target, 4));
+        BOOST_CHECK_EQUAL(0, memcmp(target, "abcd", 4));
+        buf->close();
+        finish_test();
+    };
+    buf->putn(&written, 1, handler_write);
+}
+
+// a producer writing with alloc()/commit() and waiting with wait_for_space() stops at the high watermark
+// and is resumed once the consumer drains the buffer to the low one
+void test_producer_consumer_watermarks()
+{
+    static prod_cons_buf_ptr buf;
+    static size_t produced;
+    static int turns;
+    static uint8_t target[64];
+
+    buf = std::make_shared<snode::streams::producer_consumer_buffer<char_type>>();
+    buf->get_impl()->set_watermarks(64, 16);
+    produced = 0;
+    turns = 0;
+
+    struct producer
+    {
+        static void write(size_t count)
+        {
+            auto data = buf->alloc(32);
+            if (!data)
+                return;
+            std::fill(data, data + 32, (uint8_t)(produced / 32));
+            buf->commit(32);
+            produced += 32;
+            buf->get_impl()->wait_for_space(&producer::write);
+        }
+    };
+
+    struct consumer
+    {
+        // let the producer run a few turns before every check
+        static bool wait(void (*next)())
+        {
+            if (++turns % 8)
+            {
+                snode::async_task::connect(next);
+                return true;
+            }
+            return false;
+        }
+
+        static void held_back()
+        {
+            if (wait(&consumer::held_back))
+                return;
+
+            BOOST_CHECK_EQUAL(64, produced);
+            BOOST_CHECK_EQUAL(64, buf->in_avail());
+
+            // 16 characters left reach the low watermark
+            BOOST_CHECK_EQUAL(48, buf->sgetn(target, 48));
+            snode::async_task::connect(&consumer::resumed);
+        }
+
+        static void resumed()
+        {
+            if (wait(&consumer::resumed))
+                return;
+
+            BOOST_CHECK_EQUAL(128, produced);
+            BOOST_CHECK_EQUAL(80, buf->in_avail());
+            buf->close();
+            finish_test();
+        }
+    };
+
+    producer::write(0);
+    snode::async_task::connect(&consumer::held_back);
+}
+
+// producer on the first worker, consumer on the last one
+void test_concurrent_buffer_putn_getn()
+{
+    typedef snode::streams::concurrent_buffer<char_type> concurrent_type;
+    static const size_t s_total = 1024 * 1024;
+    static std::shared_ptr<concurrent_type> buf;
+    static std::vector<uint8_t> received;
+    static uint8_t data[1000];
+    static uint8_t target[700];
+    static size_t written;
+
+    auto threads = snode::snode_core::instance().get_threadpool().threads();
+    snode::thread_id_t consumer = threads.back()->get_id();
+
+    buf = std::make_shared<concurrent_type>(4096);
+    buf->set_watermarks(64 * 1024, 16 * 1024);
+    received.clear();
+    written = 0;
+    for (size_t i = 0; i < sizeof(data); i++)
+        data[i] = (uint8_t)i;
+
+    struct producer
+    {
+        static void write(size_t count)
+        {
+            written += count;
+            if (written >= s_total)
+            {
+                buf->close(std::ios_base::out);
+                return;
+            }
+            buf->putn(data, std::min(sizeof(data), s_total - written), &producer::write);
+        }
+    };
+
+    struct reader
+    {
+        static void start()
+        {
+            buf->getn(target, sizeof(target), &reader::read);
+        }
+
+        static void read(size_t count)
+        {
+            if (!count)
+            {
+                BOOST_CHECK_EQUAL(s_total, received.size());
+                for (size_t i = 0; i < received.size(); i++)
+                {
+                    if (received[i] != data[i % sizeof(data)])
+                    {
+                        BOOST_CHECK_EQUAL(data[i % sizeof(data)], received[i]);
+                        break;
+                    }
+                }
+                finish_test();
+                return;
+            }
+            received.insert(received.end(), target, target + count);
+            buf->getn(target, sizeof(target), &reader::read);
+        }
+    };
+
+    snode::async_task::connect(&reader::start, consumer);
+    buf->putn(data, sizeof(data), &producer::write);
+}
+
 // unit test entry point
 test_suite*
 init_unit_test_suite( int argc, char* argv[] )
@@ -516,6 +757,11 @@ init_unit_test_suite( int argc, char* argv[] )
     auto test_case_producer_consumer_sgetc = std::bind(&async_streambuf_test_base, test_producer_consumer_sgetc);
     auto test_case_producer_consumer_bumpc = std::bind(&async_streambuf_test_base, test_producer_consumer_bumpc);
     auto test_case_producer_consumer_alloc_commt = std::bind(&async_streambuf_test_base, test_producer_consumer_alloc_commt);
+    auto test_case_producer_consumer_alloc_reuse = std::bind(&async_streambuf_test_base, test_producer_consumer_alloc_reuse);
+    auto test_case_producer_consumer_block_reuse = std::bind(&async_streambuf_test_base, test_producer_consumer_block_reuse);
+    auto test_case_producer_consumer_alloc_order = std::bind(&async_streambuf_test_base, test_producer_consumer_alloc_order);
+    auto test_case_producer_consumer_watermarks = std::bind(&async_streambuf_test_base, test_producer_consumer_watermarks);
+    auto test_case_concurrent_buffer_putn_getn = std::bind(&async_streambuf_test_base, test_concurrent_buffer_putn_getn);
 
     framework::master_test_suite().add(BOOST_TEST_CASE(test_case_producer_consumer_putn));
     framework::master_test_suite().add(BOOST_TEST_CASE(test_case_producer_consumer_putc));
@@ -524,6 +770,11 @@ init_unit_test_suite( int argc, char* argv[] )
     framework::master_test_suite().add(BOOST_TEST_CASE(test_case_producer_consumer_sgetc));
     framework::master_test_suite().add(BOOST_TEST_CASE(test_case_producer_consumer_bumpc));
     framework::master_test_suite().add(BOOST_TEST_CASE(test_case_producer_consumer_alloc_commt));
+    framework::master_test_suite().add(BOOST_TEST_CASE(test_case_producer_consumer_alloc_reuse));
+    framework::master_test_suite().add(BOOST_TEST_CASE(test_case_producer_consumer_block_reuse));
+    framework::master_test_suite().add(BOOST_TEST_CASE(test_case_producer_consumer_alloc_order));
+    framework::master_test_suite().add(BOOST_TEST_CASE(test_case_producer_consumer_watermarks));
+    framework::master_test_suite().add(BOOST_TEST_CASE(test_case_concurrent_buffer_putn_getn));
 
     return 0;
 }
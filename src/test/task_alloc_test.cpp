@@ -0,0 +1,100 @@
+//
+// task_alloc_test.cpp
+// Counts global heap allocations made by threadpool::schedule() against the slab allocator counters.
+// After warm up typical tasks (a bound member function with a few arguments) must not touch malloc.
+//
+// compile
+// g++ -std=c++11 -O2 task_alloc_test.cpp ../cpu_affinity.cpp -o task_alloc_test -lpthread -lboost_system -lboost_thread
+
+#include <atomic>
+#include <cstdlib>
+#include <iostream>
+#include <functional>
+#include <memory>
+#include <new>
+
+#include "../threadpool.h"
+
+static std::atomic<unsigned long> s_heap_allocs(0);
+
+void* operator new(std::size_t size)
+{
+    s_heap_allocs++;
+    if (void* p = std::malloc(size))
+        return p;
+    throw std::bad_alloc();
+}
+
+void operator delete(void* p) noexcept
+{
+    std::free(p);
+}
+
+void operator delete(void* p, std::size_t) noexcept
+{
+    std::free(p);
+}
+
+struct session
+{
+    session() : bytes_(0), calls_(0) {}
+    void on_data(std::size_t size, int chunk, std::shared_ptr<int> owner)
+    {
+        bytes_ += size + chunk + *owner;
+        calls_++;
+    }
+    std::size_t bytes_;
+    std::atomic<unsigned long> calls_;
+};
+
+/// Schedule (tasks) pairs of tasks to two workers and wait until all of them ran.
+static void run_pass(snode::threadpool& pool, unsigned long tasks)
+{
+    auto threads = pool.threads();
+    session sess;
+    std::shared_ptr<int> owner = std::make_shared<int>(0);
+    std::atomic<unsigned long> done(0);
+
+    for (unsigned long i = 0; i < tasks; i++)
+    {
+        // same shape as async_task::connect(&session::on_data, this, size, chunk, owner, thread_id)
+        pool.schedule(std::bind(&session::on_data, &sess, i, 0, owner), threads[0]->get_id());
+        pool.schedule([&done]() { done++; }, threads[1]->get_id());
+        // keep both queues short so freed nodes recycle
+        while (sess.calls_ + 1024 < i || done + 1024 < i)
+            boost::this_thread::yield();
+    }
+    while (sess.calls_ != tasks || done != tasks)
+        boost::this_thread::yield();
+}
+
+int main()
+{
+    const unsigned long tasks = 1000000;
+    // allocations the measured pass makes outside the tasks (the thread list copy, the shared owner)
+    const unsigned long max_heap = 64;
+    snode::threadpool pool(2);
+
+    // warm up, fills the slab caches and the depot with task nodes
+    run_pass(pool, tasks);
+
+    snode::slab_stats warm = snode::threadpool::task_alloc_stats();
+    unsigned long before = s_heap_allocs;
+    run_pass(pool, tasks);
+    unsigned long heap = s_heap_allocs - before;
+
+    snode::slab_stats stats = snode::threadpool::task_alloc_stats();
+    std::cout << "tasks scheduled   : " << 2 * tasks << std::endl;
+    std::cout << "heap allocations  : " << heap << std::endl;
+    std::cout << "slab hits         : " << stats.hits - warm.hits << std::endl;
+    std::cout << "slab misses       : " << stats.misses - warm.misses << std::endl;
+    std::cout << "slab oversize     : " << stats.oversize - warm.oversize << std::endl;
+    std::cout << "slab releases     : " << stats.releases - warm.releases << std::endl;
+
+    if (heap > max_heap || stats.misses != warm.misses)
+    {
+        std::cout << "FAILED: tasks allocate from the heap after warm up" << std::endl;
+        return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,114 @@
+//
+// task_queue_bench.cpp
+// Threadpool task queue benchmark, mutex/condvar synchronised_queue against the lock free mpsc_queue.
+// N producers post tasks to a single consumer which runs them, as threadpool::schedule() does.
+//
+// compile
+// g++ -std=c++11 -O2 -Wall task_queue_bench.cpp -o task_queue_bench -lpthread -lboost_system -lboost_thread
+//
+// run
+// ./task_queue_bench [tasks per producer]
+
+#include <atomic>
+#include <chrono>
+#include <cstdlib>
+#include <iostream>
+#include <thread>
+#include <vector>
+
+#include "../async_op.h"
+#include "../mpsc_queue.h"
+#include "../synchronised_queue.h"
+
+struct stop_consumer {};
+
+struct count_task
+{
+    void operator()()
+    {
+        (*counter_)++;
+    }
+    unsigned long* counter_;
+};
+
+struct synchronised_adapter
+{
+    void enqueue(async_op_base* op) { queue_.enqueue(op); }
+    async_op_base* dequeue() { return queue_.dequeue(); }
+    snode::synchronised_queue<async_op_base*> queue_;
+};
+
+struct mpsc_adapter
+{
+    void enqueue(async_op_base* op) { queue_.enqueue(op); }
+    async_op_base* dequeue() { return queue_.dequeue(); }
+    snode::mpsc_queue<async_op_base> queue_;
+};
+
+template<typename Queue>
+double run(unsigned producers, unsigned long tasks)
+{
+    Queue queue;
+    unsigned long executed = 0;
+    std::atomic<unsigned> done(0);
+
+    auto start = std::chrono::steady_clock::now();
+    std::thread consumer([&]()
+    {
+        while (true)
+        {
+            async_op_base* op = queue.dequeue();
+            try
+            {
+                op->run();
+                delete op;
+            }
+            catch (const stop_consumer&)
+            {
+                delete op;
+                return;
+            }
+        }
+    });
+
+    std::vector<std::thread> workers;
+    for (unsigned i = 0; i < producers; i++)
+    {
+        workers.push_back(std::thread([&]()
+        {
+            for (unsigned long n = 0; n < tasks; n++)
+            {
+                count_task task = { &executed };
+                queue.enqueue(new async_op<count_task>(task));
+            }
+            if (++done == producers)
+                queue.enqueue(new async_op<void (*)()>([]() { throw stop_consumer(); }));
+        }));
+    }
+
+    for (auto& worker : workers)
+        worker.join();
+    consumer.join();
+    std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+
+    if (executed != producers * tasks)
+        std::cerr << "lost tasks " << producers * tasks - executed << std::endl;
+    return executed / elapsed.count();
+}
+
+int main(int argc, char* argv[])
+{
+    unsigned long tasks = argc > 1 ? std::atol(argv[1]) : 1000000;
+    unsigned producer_counts[] = { 1, 2, 4, 8 };
+
+    std::cout << tasks << " tasks per producer" << std::endl;
+    std::cout << "producers\tsynchronised_queue (tasks/s)\tmpsc_queue (tasks/s)" << std::endl;
+    for (auto producers : producer_counts)
+    {
+        double locked = run<synchronised_adapter>(producers, tasks);
+        double lockfree = run<mpsc_adapter>(producers, tasks);
+        std::cout << producers << "\t\t" << static_cast<unsigned long>(locked)
+                  << "\t\t\t" << static_cast<unsigned long>(lockfree) << std::endl;
+    }
+    return 0;
+}
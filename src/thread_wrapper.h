@@ -51,6 +51,14 @@ namespace lib {
     #define THIS_THREAD_ID() boost::this_thread::get_id()
 #endif
 
+    /// Lock that does nothing, for data touched by a single thread.
+    struct null_mutex
+    {
+        void lock() {}
+        void unlock() {}
+        bool try_lock() { return true; }
+    };
+
 } // namespace lib
 } // namespace snode
 
@@ -7,15 +7,19 @@
 #define THREADPOOL_H_
 
 #include <map>
+#include <atomic>
 #include <vector>
 #include <functional>
 #include <boost/asio.hpp>
 #include <boost/date_time/posix_time/posix_time.hpp>
 
-#include "synchronised_queue.h"
+#include "mpsc_queue.h"
+#include "steal_queue.h"
 #include "thread_wrapper.h"
 #include "snode_types.h"
 #include "async_op.h"
+#include "slab_allocator.h"
+#include "cpu_affinity.h"
 
 namespace snode
 {
@@ -24,20 +28,121 @@ namespace snode
 struct cancel_thread_err {};
 static const char* s_threadpool_msg = "invalid thread id";
 
+/// A chain of tasks for one worker, scheduled with a single queue operation by threadpool::schedule_batch().
+/// Tasks run in the order they were added. The batch is empty again after it is scheduled.
+class task_batch
+{
+public:
+    task_batch() : first_(nullptr), last_(nullptr), size_(0)
+    {}
+
+    ~task_batch()
+    {
+        clear();
+    }
+
+    /// Add a task, anything with () operator defined.
+    template<typename T>
+    void add(T task)
+    {
+        async_op_base* op = new async_op<T>(task);
+        op->next_.store(nullptr, std::memory_order_relaxed);
+        if (last_)
+            last_->next_.store(op, std::memory_order_relaxed);
+        else
+            first_ = op;
+        last_ = op;
+        size_++;
+    }
+
+    /// Get the task count.
+    std::size_t size() const
+    {
+        return size_;
+    }
+
+    bool empty() const
+    {
+        return 0 == size_;
+    }
+
+    /// Drop all tasks without running them.
+    void clear()
+    {
+        while (first_)
+        {
+            async_op_base* op = next(first_);
+            delete first_;
+            first_ = op;
+        }
+        release();
+    }
+
+private:
+    friend class threadpool;
+
+    task_batch(const task_batch&) = delete;
+    task_batch& operator=(const task_batch&) = delete;
+
+    static async_op_base* next(async_op_base* op)
+    {
+        return static_cast<async_op_base*>(op->next_.load(std::memory_order_relaxed));
+    }
+
+    /// Ownership of the chain is passed to the caller.
+    void release()
+    {
+        first_ = last_ = nullptr;
+        size_ = 0;
+    }
+
+    async_op_base* first_;
+    async_op_base* last_;
+    std::size_t size_;
+};
+
 /// General purpose thread pool,
 /// creates a dedicated pool of threads for task/operations that will slow down or interrupt I/O handling.
+/// In multi-reactor mode every worker owns an io_service and runs it, tasks are posted to the worker's io_service
+/// and socket I/O bound to that io_service completes directly on the worker.
+/// Tasks scheduled with schedule() are pinned to a worker, tasks scheduled with schedule_any() have no affinity
+/// and are load balanced between the workers by work stealing.
+/// Workers have dense indices [0, size), a worker finds its own index through a thread local,
+/// so scheduling to the calling worker or to a known index is plain array indexing.
+/// Workers can be pinned to CPUs and a NUMA node (worker_placement), a worker allocates its own queues after placement.
 class threadpool
 {
 public:
 
-    threadpool(size_t size = 1) : size_(size)
+    threadpool(size_t size = 1, bool multi_reactor = false, const worker_placement_list& placement = worker_placement_list())
+        : size_(size), multi_reactor_(multi_reactor), started_(false), ready_(0), next_service_(0), next_worker_(0), pending_any_(0)
     {
+        workers_.resize(size_);
+
         // pool is created and started
         for (size_t i = 0; i < size_; i++)
         {
-            thread_ptr thread = std::make_shared<snode::lib::thread>(std::bind(&threadpool::start_thread, this));
-            threads_.push_back(thread);
+            worker& w = workers_[i];
+            if (!placement.empty())
+                w.placement_ = placement[i % placement.size()];
+
+            if (multi_reactor_)
+                w.thread_ = std::make_shared<snode::lib::thread>(std::bind(&threadpool::run_io_service, this, i));
+            else
+                w.thread_ = std::make_shared<snode::lib::thread>(std::bind(&threadpool::start_thread, this, i));
+
+            w.id_ = w.thread_->get_id();
+            index_.insert(std::pair<thread_id_t, std::size_t>(w.id_, i));
+            threads_.push_back(w.thread_);
         }
+
+        // every worker creates its own queues (on its own NUMA node), wait for them
+        // and let them run, the worker table is not modified until stop()
+        boost::unique_lock<boost::mutex> lock_guard(start_lock_);
+        while (ready_ < size_)
+            start_condvar_.wait(lock_guard);
+        started_ = true;
+        start_condvar_.notify_all();
     }
 
     ~threadpool()
@@ -48,19 +153,30 @@ public:
     void stop()
     {
         // prevent a second stop
-        if (threads_.empty() || queues_index_.empty())
+        if (workers_.empty())
             return;
 
-        for (auto iter = threads_.begin(); iter != threads_.end(); ++iter)
+        for (std::size_t i = 0; i < workers_.size(); i++)
         {
-            thread_ptr thread = *iter;
-            stop_thread(thread->get_id());
-            thread->join();
+            stop_thread(i);
+            workers_[i].thread_->join();
+        }
+
+        // tasks without affinity left behind by the cancelled workers
+        for (auto iter = workers_.begin(); iter != workers_.end(); ++iter)
+        {
+            if (!iter->steal_queue_)
+                continue;
+
+            while (auto pending = iter->steal_queue_->steal())
+                delete pending;
         }
 
         // clear all threads and queues run() will create new ones
         threads_.clear();
-        queues_index_.clear();
+        workers_.clear();
+        index_.clear();
+        pending_any_ = 0;
     }
 
     /// Post a task to a given thread. Task can be anything as long it has () operator defined.
@@ -68,39 +184,361 @@ public:
     template<typename T>
     void schedule(T task, thread_id_t id)
     {
-        // match the task queue with thread id
-        auto it = queues_index_.find(id);
+        schedule_at(task, worker_index(id));
+    }
+
+    /// Post a task to the worker with the given index.
+    /// Throws runtime_error on error.
+    template<typename T>
+    void schedule_at(T task, std::size_t index)
+    {
+        if (index >= workers_.size())
+        {
+            throw std::runtime_error(s_threadpool_msg);
+        }
+
+        if (multi_reactor_)
+        {
+            workers_[index].service_->post(slab_handler<T>(task));
+            return;
+        }
+
+        async_op<T>* op = new async_op<T>(task);
+        workers_[index].queue_->enqueue(op);
+    }
+
+    /// Post all tasks from a batch to a given thread with one queue operation and at most one wakeup.
+    /// Throws runtime_error on error, the batch is left untouched.
+    void schedule_batch(task_batch& batch, thread_id_t id)
+    {
+        schedule_batch_at(batch, worker_index(id));
+    }
 
-        if (queues_index_.end() == it)
+    /// Post all tasks from a batch to the worker with the given index.
+    /// Throws runtime_error on error, the batch is left untouched.
+    void schedule_batch_at(task_batch& batch, std::size_t index)
+    {
+        if (index >= workers_.size())
+        {
+            throw std::runtime_error(s_threadpool_msg);
+        }
+
+        if (batch.empty())
+            return;
+
+        if (multi_reactor_)
+        {
+            // a single handler runs the whole chain
+            workers_[index].service_->post(slab_handler<batch_runner>(batch_runner(batch.first_)));
+        }
+        else
+        {
+            workers_[index].queue_->enqueue_chain(batch.first_, batch.last_);
+        }
+        batch.release();
+    }
+
+    /// Post a task with no thread affinity, it is executed by whichever worker gets to it first.
+    /// Called from a worker the task goes to that worker's own deque, otherwise workers are picked round robin.
+    /// Idle workers steal tasks from busy ones. Use schedule() for tasks that must run on a given thread
+    /// (stream buffer continuations, connection handlers).
+    /// Throws runtime_error if the pool is stopped.
+    template<typename T>
+    void schedule_any(T task)
+    {
+        if (workers_.empty())
         {
             throw std::runtime_error(s_threadpool_msg);
         }
 
+        if (multi_reactor_)
+        {
+            // io_services are not shared, balance by round robin instead
+            next_io_service().post(slab_handler<T>(task));
+            return;
+        }
+
+        worker_slot& slot = local_worker();
+        std::size_t index = (this == slot.pool_) ? slot.index_ : next_worker_++ % size_;
+
+        // count the task once it can be taken, a worker seeing the count finds it in a deque
         async_op<T>* op = new async_op<T>(task);
-        it->second->enqueue(op);
+        workers_[index].steal_queue_->push(op);
+        pending_any_++;
+
+        // wake the owner, if it is busy wake some parked worker to steal the task
+        if (workers_[index].queue_->notify())
+            return;
+
+        for (std::size_t i = 1; i < size_; i++)
+        {
+            if (workers_[(index + i) % size_].queue_->notify())
+                return;
+        }
+    }
+
+    /// Get the index of the worker with the given thread id.
+    /// Called with the id of the calling worker (THIS_THREAD_ID()) it is resolved without a lookup.
+    /// Throws runtime_error if the id is not a worker.
+    std::size_t worker_index(thread_id_t id) const
+    {
+        const worker_slot& slot = local_worker();
+        if (this == slot.pool_ && workers_[slot.index_].id_ == id)
+            return slot.index_;
+
+        auto it = index_.find(id);
+
+        if (index_.end() == it)
+        {
+            throw std::runtime_error(s_threadpool_msg);
+        }
+
+        return it->second;
+    }
+
+    /// Get the index of the calling worker.
+    /// Throws runtime_error if the caller is not a worker of this pool.
+    std::size_t current_worker() const
+    {
+        const worker_slot& slot = local_worker();
+        if (this != slot.pool_)
+        {
+            throw std::runtime_error(s_threadpool_msg);
+        }
+
+        return slot.index_;
     }
 
-    /// Get the direct thread interface pool
+    /// Check if the caller is a worker of this pool.
+    bool is_worker() const
+    {
+        return this == local_worker().pool_;
+    }
+
+    /// Get the task allocation counters summed over all threads.
+    static slab_stats task_alloc_stats()
+    {
+        return slab_allocator::stats();
+    }
+
+    /// Get the direct thread interface pool, index in the vector is the worker index.
     const std::vector<thread_ptr>& threads() const
     {
         return threads_;
     }
 
+    /// Get the worker count.
+    std::size_t size() const
+    {
+        return workers_.size();
+    }
+
+    /// Check if every worker thread runs its own io_service (multi-reactor mode).
+    bool multi_reactor() const
+    {
+        return multi_reactor_;
+    }
+
+    /// Get the io_service owned by the worker thread with the given id.
+    /// Throws runtime_error if the pool is not in multi-reactor mode or the id is not a worker.
+    boost::asio::io_service& get_io_service(thread_id_t id)
+    {
+        return get_worker_io_service(worker_index(id));
+    }
+
+    /// Get the io_service owned by the worker with the given index.
+    /// Throws runtime_error if the pool is not in multi-reactor mode or the index is not a worker.
+    boost::asio::io_service& get_worker_io_service(std::size_t index)
+    {
+        if (index >= workers_.size() || !multi_reactor_)
+        {
+            throw std::runtime_error(s_threadpool_msg);
+        }
+
+        return *workers_[index].service_;
+    }
+
+    /// Round robin mechanism for fetching a worker io_service, sockets created on it are served by that worker.
+    /// Throws runtime_error if the pool is not in multi-reactor mode.
+    boost::asio::io_service& next_io_service()
+    {
+        if (workers_.empty() || !multi_reactor_)
+        {
+            throw std::runtime_error(s_threadpool_msg);
+        }
+
+        return *workers_[next_service_++ % workers_.size()].service_;
+    }
+
+    /// Get the index of the worker running the given io_service.
+    /// Throws runtime_error if the io_service is not owned by a worker.
+    std::size_t io_service_owner(const boost::asio::io_service& ios) const
+    {
+        const worker_slot& slot = local_worker();
+        if (this == slot.pool_ && workers_[slot.index_].service_.get() == &ios)
+            return slot.index_;
+
+        for (std::size_t i = 0; i < workers_.size(); i++)
+        {
+            if (workers_[i].service_.get() == &ios)
+                return i;
+        }
+
+        throw std::runtime_error(s_threadpool_msg);
+    }
+
 private:
 
-    typedef synchronised_queue<async_op_base*> task_queue_t;
+    typedef mpsc_queue<async_op_base> task_queue_t;
     typedef std::shared_ptr<task_queue_t> task_queue_ptr;
+    typedef steal_queue<async_op_base> steal_queue_t;
+    typedef std::shared_ptr<steal_queue_t> steal_queue_ptr;
+
+    /// Runs and frees a chain of tasks posted as one io_service handler.
+    /// Owns the chain, a copy takes it over (handlers are copied while posted),
+    /// tasks not run because the io_service is destroyed or a task threw are freed with the runner.
+    struct batch_runner
+    {
+        batch_runner(async_op_base* first) : first_(first)
+        {}
+
+        batch_runner(const batch_runner& other) : first_(other.first_)
+        {
+            other.first_ = nullptr;
+        }
+
+        ~batch_runner()
+        {
+            while (first_)
+            {
+                async_op_base* op = task_batch::next(first_);
+                delete first_;
+                first_ = op;
+            }
+        }
+
+        void operator()()
+        {
+            while (first_)
+            {
+                async_op_base* op = task_batch::next(first_);
+                first_->run();
+                delete first_;
+                first_ = op;
+            }
+        }
+
+        mutable async_op_base* first_;
+
+    private:
+        batch_runner& operator=(const batch_runner&) = delete;
+    };
+
+    /// Per worker state, pinned task queue and work stealing deque, or the io_service in multi-reactor mode.
+    struct worker
+    {
+        thread_ptr thread_;
+        thread_id_t id_;
+        task_queue_ptr queue_;
+        steal_queue_ptr steal_queue_;
+        io_service_ptr service_;
+        worker_placement placement_;
+    };
+
+    /// Identifies the pool and worker index of the calling thread.
+    struct worker_slot
+    {
+        const threadpool* pool_;
+        std::size_t index_;
+    };
+
+    static worker_slot& local_worker()
+    {
+        static thread_local worker_slot slot = { nullptr, 0 };
+        return slot;
+    }
+
+    /// Apply the worker placement, create the worker's queues and wait for the constructor to complete the worker table.
+    /// Registers the calling worker.
+    void enter_worker(std::size_t index)
+    {
+        worker& w = workers_[index];
+        apply_worker_placement(w.placement_);
+
+        if (multi_reactor_)
+        {
+            w.service_ = std::make_shared<boost::asio::io_service>();
+        }
+        else
+        {
+            w.queue_ = std::make_shared<task_queue_t>();
+            w.steal_queue_ = std::make_shared<steal_queue_t>();
+        }
+
+        {
+            boost::unique_lock<boost::mutex> lock_guard(start_lock_);
+            ready_++;
+            start_condvar_.notify_all();
+            while (!started_)
+                start_condvar_.wait(lock_guard);
+        }
+
+        worker_slot& slot = local_worker();
+        slot.pool_ = this;
+        slot.index_ = index;
+    }
+
+    /// Get a task with no affinity, own deque first then steal from the others.
+    async_op_base* take_any(std::size_t index)
+    {
+        // may be negative for a moment, a thief can take a task before schedule_any() counts it
+        if (pending_any_.load() <= 0)
+            return nullptr;
+
+        async_op_base* task = workers_[index].steal_queue_->pop();
+        for (std::size_t i = 1; !task && i < size_; i++)
+            task = workers_[(index + i) % size_].steal_queue_->steal();
+
+        if (task)
+            pending_any_--;
+        return task;
+    }
+
+    /// Check whether take_any() can get a task, a worker parks otherwise.
+    /// Counted tasks already taken by other workers, but not yet uncounted, do not keep it awake.
+    bool any_task_available() const
+    {
+        if (pending_any_.load() <= 0)
+            return false;
+
+        for (std::size_t i = 0; i < size_; i++)
+        {
+            if (!workers_[i].steal_queue_->empty())
+                return true;
+        }
+        return false;
+    }
 
     /// Thread entry function.
-    void start_thread()
+    void start_thread(std::size_t index)
     {
-        task_queue_ptr queue(new task_queue_t);
-        queues_index_.insert(std::pair<thread_id_t, task_queue_ptr>(boost::this_thread::get_id(), queue));
+        enter_worker(index);
+
+        task_queue_ptr queue = workers_[index].queue_;
         while (true)
         {
             try
             {
-                auto task = queue->dequeue();
+                // pinned tasks first, then tasks with no affinity, park when there is nothing to do.
+                // Everything available is drained before the worker parks again.
+                auto task = queue->try_dequeue();
+                if (!task)
+                    task = take_any(index);
+                if (!task)
+                    task = queue->dequeue([this]() { return any_task_available(); });
+                if (!task)
+                    continue;
+
                 task->run();
                 delete task;
             }
@@ -108,6 +546,8 @@ private:
             {
                 // thread was cancelled,
                 // all queued tasks will not be executed
+                while (auto pending = queue->try_dequeue())
+                    delete pending;
                 return;
             }
             catch (...)
@@ -118,17 +558,45 @@ private:
         }
     }
 
+    /// Thread entry function in multi-reactor mode, the worker runs its own io_service.
+    void run_io_service(std::size_t index)
+    {
+        enter_worker(index);
+
+        io_service_ptr ios = workers_[index].service_;
+        // keep run() from returning when there is no pending work
+        boost::asio::io_service::work work(*ios);
+        try
+        {
+            ios->run();
+        }
+        catch (const cancel_thread_err&)
+        {
+            // thread was cancelled,
+            // all posted tasks will not be executed
+            return;
+        }
+    }
+
     /// Stop thread, internal method.
-    void stop_thread(thread_id_t id)
+    void stop_thread(std::size_t index)
     {
-    	schedule([]() -> void { throw cancel_thread_err(); }, id);
+    	schedule_at([]() -> void { throw cancel_thread_err(); }, index);
     }
 
     std::size_t size_;
+    bool multi_reactor_;
+    bool started_;
+    std::size_t ready_;
+    boost::mutex start_lock_;
+    boost::condition_variable start_condvar_;
+    std::atomic<std::size_t> next_service_;
+    std::atomic<std::size_t> next_worker_;
+    std::atomic<long> pending_any_;
     std::vector<thread_ptr> threads_;
-    std::map<thread_id_t, task_queue_ptr> queues_index_;
+    std::vector<worker> workers_;
+    std::map<thread_id_t, std::size_t> index_;
 };
 
 }
 #endif /* THREADPOOL_H_ */
-
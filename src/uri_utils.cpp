@@ -3,109 +3,251 @@
 // Copyright (C) 2015  Emil Penchev, Bulgaria
 
 #include "uri_utils.h"
-#include <sstream>
+
+#include <limits>
 
 namespace snode
 {
 
-std::vector<std::string> uri::split_path(const std::string& uri)
+namespace
 {
-    std::vector<std::string> results;
-    std::string path;
+    inline bool is_alpha(char ch)
+    {
+        return (ch >= 'a' && ch <= 'z') || (ch >= 'A' && ch <= 'Z');
+    }
 
-    std::size_t colon_found = uri.find_first_of(':');
-    if (colon_found != std::string::npos)
+    inline bool is_digit(char ch)
     {
-        // found a colon, the first portion is a scheme
-        if (uri[colon_found + 1] == '/' && uri[colon_found + 2] == '/')
+        return ch >= '0' && ch <= '9';
+    }
+
+    inline bool is_hex(char ch)
+    {
+        return is_digit(ch) || (ch >= 'a' && ch <= 'f') || (ch >= 'A' && ch <= 'F');
+    }
+
+    inline bool is_scheme_char(char ch)
+    {
+        return is_alpha(ch) || is_digit(ch) || '+' == ch || '-' == ch || '.' == ch;
+    }
+
+    /// Scan [pos, end) up to the first of the delimiters, checks for characters not allowed in a URI
+    /// (controls, space, non ASCII) and for malformed percent escapes. Returns end on error.
+    size_t scan(boost::string_ref uri, size_t pos, const char* delimiters, bool& valid)
+    {
+        for (; pos < uri.size(); pos++)
         {
-            std::size_t end_scheme = (colon_found + 2);
-            std::size_t path_begin = uri.find_first_of('/', end_scheme + 1);
-            if (path_begin != std::string::npos)
+            char ch = uri[pos];
+            for (const char* d = delimiters; *d; d++)
+            {
+                if (ch == *d)
+                    return pos;
+            }
+
+            unsigned char uch = static_cast<unsigned char>(ch);
+            if (uch <= 0x20 || uch >= 0x7f)
+            {
+                valid = false;
+                return uri.size();
+            }
+
+            if ('%' == ch)
             {
-                path.assign(uri, path_begin + 1, uri.length() - (path_begin + 1));
+                if (pos + 2 >= uri.size() || !is_hex(uri[pos + 1]) || !is_hex(uri[pos + 2]))
+                {
+                    valid = false;
+                    return uri.size();
+                }
+                pos += 2;
             }
         }
+        return pos;
     }
+}
+
+void uri_components::clear()
+{
+    data_ = nullptr;
+    scheme_ = user_info_ = host_ = path_ = query_ = fragment_ = make_span(0, 0);
+    port_ = -1;
+}
 
-    if (!path.empty())
+bool uri_components::parse(boost::string_ref uri)
+{
+    clear();
+    if (uri.size() > std::numeric_limits<uint32_t>::max())
+        return false;
+
+    data_ = uri.data();
+    bool valid = true;
+    size_t pos = 0;
+
+    // scheme ":"
+    if (!uri.empty() && is_alpha(uri[0]))
     {
-        std::istringstream iss(path);
+        size_t end = 1;
+        while (end < uri.size() && is_scheme_char(uri[end]))
+            end++;
 
-        iss.imbue(std::locale::classic());
-        std::string str;
+        if (end < uri.size() && ':' == uri[end])
+        {
+            // authority form "host:port" as in CONNECT requests
+            size_t digits = end + 1;
+            while (digits < uri.size() && is_digit(uri[digits]))
+                digits++;
 
-        while (std::getline(iss, str, '/'))
+            if (digits == uri.size() && digits > end + 1)
+            {
+                if (!parse_authority(0, uri.size()))
+                {
+                    clear();
+                    return false;
+                }
+                return true;
+            }
+
+            scheme_ = make_span(0, end);
+            pos = end + 1;
+        }
+    }
+
+    // "//" authority
+    if (pos + 1 < uri.size() && '/' == uri[pos] && '/' == uri[pos + 1])
+    {
+        size_t end = scan(uri, pos + 2, "/?#", valid);
+        if (!valid || !parse_authority(pos + 2, end))
         {
-            if (!str.empty())
-                results.push_back(str);
+            clear();
+            return false;
         }
+        pos = end;
+    }
+
+    size_t end = scan(uri, pos, "?#", valid);
+    path_ = make_span(pos, end);
+    pos = end;
+
+    if (valid && pos < uri.size() && '?' == uri[pos])
+    {
+        end = scan(uri, pos + 1, "#", valid);
+        query_ = make_span(pos + 1, end);
+        pos = end;
+    }
+
+    if (valid && pos < uri.size() && '#' == uri[pos])
+    {
+        end = scan(uri, pos + 1, "", valid);
+        fragment_ = make_span(pos + 1, end);
+    }
+
+    if (!valid)
+    {
+        clear();
+        return false;
+    }
+    return true;
+}
+
+bool uri_components::parse_authority(size_t begin, size_t end)
+{
+    boost::string_ref authority(data_ + begin, end - begin);
+
+    size_t at = authority.rfind('@');
+    size_t host_begin = 0;
+    if (at != boost::string_ref::npos)
+    {
+        user_info_ = make_span(begin, begin + at);
+        host_begin = at + 1;
+    }
+
+    size_t host_end = host_begin;
+    if (host_end < authority.size() && '[' == authority[host_end])
+    {
+        // IP literal
+        size_t close = authority.find(']');
+        if (boost::string_ref::npos == close || close < host_end)
+            return false;
+        host_end = close + 1;
+    }
+    else
+    {
+        while (host_end < authority.size() && authority[host_end] != ':')
+            host_end++;
+    }
+    host_ = make_span(begin + host_begin, begin + host_end);
+
+    if (host_end == authority.size())
+        return true;
+
+    if (authority[host_end] != ':')
+        return false;
+
+    // an empty port is allowed and means the default one
+    int port = -1;
+    for (size_t i = host_end + 1; i < authority.size(); i++)
+    {
+        if (!is_digit(authority[i]))
+            return false;
+        port = (port < 0 ? 0 : port) * 10 + (authority[i] - '0');
+        if (port > 65535)
+            return false;
+    }
+    port_ = port;
+    return true;
+}
+
+std::vector<std::string> uri::split_path(const std::string& uri)
+{
+    std::vector<std::string> results;
+    uri_components components;
+    if (components.parse(uri))
+    {
+        for (auto segment : components.path_segments())
+            results.push_back(segment.to_string());
     }
     return results;
 }
 
 bool uri::validate(const std::string& uri)
 {
-    return true;
+    uri_components components;
+    return components.parse(uri);
 }
 
 std::string uri::get_host(const std::string& uri)
 {
-    return "";
+    uri_components components;
+    return components.parse(uri) ? components.host().to_string() : std::string();
 }
 
 int uri::get_port(const std::string& uri)
 {
-    return 0;
+    uri_components components;
+    return components.parse(uri) ? components.port() : -1;
 }
 
 std::string uri::get_path(const std::string& uri)
 {
-    return "";
+    uri_components components;
+    return components.parse(uri) ? components.path().to_string() : std::string();
 }
 
 std::map<std::string, std::string> uri::split_query(const std::string& uri)
 {
     std::map<std::string, std::string> results;
-
-#if 0
-   // Split into key value pairs separated by '&'.
-   size_t prev_amp_index = 0;
-   while(prev_amp_index != utility::string_t::npos)
-   {
-       size_t amp_index = query.find_first_of(_XPLATSTR('&'), prev_amp_index);
-       if (amp_index == utility::string_t::npos)
-           amp_index = query.find_first_of(_XPLATSTR(';'), prev_amp_index);
-
-       utility::string_t key_value_pair = query.substr(
-           prev_amp_index,
-           amp_index == utility::string_t::npos ? query.size() - prev_amp_index : amp_index - prev_amp_index);
-       prev_amp_index = amp_index == utility::string_t::npos ? utility::string_t::npos : amp_index + 1;
-
-       size_t equals_index = key_value_pair.find_first_of(_XPLATSTR('='));
-       if(equals_index == utility::string_t::npos)
-       {
-           continue;
-       }
-       else if (equals_index == 0)
-       {
-           utility::string_t value(key_value_pair.begin() + equals_index + 1, key_value_pair.end());
-           results[_XPLATSTR("")] = value;
-       }
-       else
-       {
-           utility::string_t key(key_value_pair.begin(), key_value_pair.begin() + equals_index);
-           utility::string_t value(key_value_pair.begin() + equals_index + 1, key_value_pair.end());
-       results[key] = value;
-       }
-   }
-#endif
-   return results;
+    uri_components components;
+    if (components.parse(uri))
+    {
+        for (auto pair : components.query_pairs())
+            results[pair.first.to_string()] = pair.second.to_string();
+    }
+    return results;
 }
 
 std::string uri::get_query(const std::string& uri)
 {
-    return "";
+    uri_components components;
+    return components.parse(uri) ? components.query().to_string() : std::string();
 }
 
 }
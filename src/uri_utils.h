@@ -8,10 +8,206 @@
 #include <string>
 #include <map>
 #include <vector>
+#include <utility>
+#include <iterator>
+#include <cstdint>
+#include <boost/utility/string_ref.hpp>
 
 namespace snode
 {
 
+/// Components of a URI (scheme, user info, host, port, path, query, fragment) found by a single pass of parse().
+/// Components are kept as offsets into the parsed string and returned as views, nothing is allocated or decoded.
+/// The views are valid as long as the parsed string is not changed or destroyed.
+class uri_components
+{
+public:
+
+    /// Lazy iterator over the non empty segments of a path.
+    class segment_iterator : public std::iterator<std::forward_iterator_tag, boost::string_ref>
+    {
+    public:
+        segment_iterator() : pos_(0) {}
+
+        segment_iterator(boost::string_ref path, size_t pos) : path_(path), pos_(pos)
+        {
+            skip();
+        }
+
+        boost::string_ref operator*() const
+        {
+            boost::string_ref rest = path_.substr(pos_);
+            return rest.substr(0, rest.find('/'));
+        }
+
+        segment_iterator& operator++()
+        {
+            pos_ += (**this).size();
+            skip();
+            return *this;
+        }
+
+        segment_iterator operator++(int)
+        {
+            segment_iterator tmp(*this);
+            ++*this;
+            return tmp;
+        }
+
+        bool operator==(const segment_iterator& other) const { return pos_ == other.pos_; }
+        bool operator!=(const segment_iterator& other) const { return pos_ != other.pos_; }
+
+    private:
+        void skip()
+        {
+            while (pos_ < path_.size() && '/' == path_[pos_])
+                pos_++;
+        }
+
+        boost::string_ref path_;
+        size_t pos_;
+    };
+
+    /// Lazy iterator over the key/value pairs of a query, pairs are separated by '&' or ';'.
+    /// A pair without '=' has an empty value, empty pairs are skipped.
+    class query_iterator : public std::iterator<std::forward_iterator_tag, std::pair<boost::string_ref, boost::string_ref> >
+    {
+    public:
+        typedef std::pair<boost::string_ref, boost::string_ref> value_type;
+
+        query_iterator() : pos_(0) {}
+
+        query_iterator(boost::string_ref query, size_t pos) : query_(query), pos_(pos)
+        {
+            skip();
+        }
+
+        value_type operator*() const
+        {
+            boost::string_ref pair = current();
+            size_t equals = pair.find('=');
+            if (boost::string_ref::npos == equals)
+                return value_type(pair, boost::string_ref());
+            return value_type(pair.substr(0, equals), pair.substr(equals + 1));
+        }
+
+        query_iterator& operator++()
+        {
+            pos_ += current().size();
+            skip();
+            return *this;
+        }
+
+        query_iterator operator++(int)
+        {
+            query_iterator tmp(*this);
+            ++*this;
+            return tmp;
+        }
+
+        bool operator==(const query_iterator& other) const { return pos_ == other.pos_; }
+        bool operator!=(const query_iterator& other) const { return pos_ != other.pos_; }
+
+    private:
+        boost::string_ref current() const
+        {
+            boost::string_ref rest = query_.substr(pos_);
+            return rest.substr(0, rest.find_first_of("&;"));
+        }
+
+        void skip()
+        {
+            while (pos_ < query_.size() && ('&' == query_[pos_] || ';' == query_[pos_]))
+                pos_++;
+        }
+
+        boost::string_ref query_;
+        size_t pos_;
+    };
+
+    /// Iterable range over the segments of the path or the pairs of the query.
+    template<typename Iterator>
+    class range
+    {
+    public:
+        range(Iterator begin, Iterator end) : begin_(begin), end_(end) {}
+        Iterator begin() const { return begin_; }
+        Iterator end() const { return end_; }
+
+    private:
+        Iterator begin_;
+        Iterator end_;
+    };
+
+    uri_components()
+    {
+        clear();
+    }
+
+    /// Split (uri) into its components, accepts absolute URIs, relative references, authority and asterisk forms.
+    /// Returns false if the URI is malformed, the components are cleared then.
+    bool parse(boost::string_ref uri);
+
+    /// Reset to an empty URI.
+    void clear();
+
+    boost::string_ref scheme() const { return view(scheme_); }
+    boost::string_ref user_info() const { return view(user_info_); }
+    boost::string_ref host() const { return view(host_); }
+    boost::string_ref path() const { return view(path_); }
+    boost::string_ref query() const { return view(query_); }
+    boost::string_ref fragment() const { return view(fragment_); }
+
+    /// Port number, -1 if no port is specified.
+    int port() const { return port_; }
+
+    /// Segments of the path, e.g. "a", "b" for "/a//b/".
+    range<segment_iterator> path_segments() const
+    {
+        boost::string_ref p = path();
+        return range<segment_iterator>(segment_iterator(p, 0), segment_iterator(p, p.size()));
+    }
+
+    /// Key/value pairs of the query.
+    range<query_iterator> query_pairs() const
+    {
+        boost::string_ref q = query();
+        return range<query_iterator>(query_iterator(q, 0), query_iterator(q, q.size()));
+    }
+
+private:
+
+    struct span
+    {
+        uint32_t offset_;
+        uint32_t size_;
+    };
+
+    boost::string_ref view(const span& s) const
+    {
+        return data_ ? boost::string_ref(data_ + s.offset_, s.size_) : boost::string_ref();
+    }
+
+    static span make_span(size_t begin, size_t end)
+    {
+        span s;
+        s.offset_ = static_cast<uint32_t>(begin);
+        s.size_ = static_cast<uint32_t>(end - begin);
+        return s;
+    }
+
+    bool parse_authority(size_t begin, size_t end);
+
+    const char* data_;
+    span scheme_;
+    span user_info_;
+    span host_;
+    span path_;
+    span query_;
+    span fragment_;
+    int port_;
+};
+
 struct uri
 {
 